@@ -0,0 +1,187 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "calib.h"
+#include "gkos.h"
+
+/*
+ * Limits how far a button's hit region may be shifted from its drawn arc
+ */
+static void clamp_btn(struct calib_btn *cb)
+{
+	const double max_dr = DR / 4, max_dth = DTH / 4;
+
+	if (cb->dr > max_dr)
+		cb->dr = max_dr;
+	else if (cb->dr < -max_dr)
+		cb->dr = -max_dr;
+	if (cb->dth > max_dth)
+		cb->dth = max_dth;
+	else if (cb->dth < -max_dth)
+		cb->dth = -max_dth;
+}
+
+/*
+ * Moves a button's hit region to follow its learned touch offset
+ */
+static void apply_btn(struct calib *cal, int i)
+{
+	struct layout_btn *btn = &cal->btns[i];
+	int dr = lround(cal->cbtns[i].dr);
+	int dth = lround(cal->cbtns[i].dth);
+
+	layout_set_hit(btn, btn->r1 + dr, btn->r2 + dr, btn->th + dth, btn->dth);
+}
+
+/*
+ * Moves every button's hit region to follow its learned offset, as after the
+ * buttons have been placed again
+ */
+void calib_apply(struct calib *cal)
+{
+	int i;
+	for (i = 0; i < cal->nbtns; i++)
+		apply_btn(cal, i);
+}
+
+/*
+ * Initializes calibration for a set of buttons, with hit regions matching the
+ * drawn arcs
+ */
+int calib_init(struct calib *cal, struct layout_btn *btns, int nbtns)
+{
+	cal->cbtns = calloc(nbtns, sizeof(cal->cbtns[0]));
+	if (!cal->cbtns) {
+		perror("calloc");
+		return 1;
+	}
+
+	cal->btns = btns;
+	cal->nbtns = nbtns;
+	cal->npending = 0;
+	cal->pending_time = 0;
+
+	calib_apply(cal);
+	return 0;
+}
+
+/*
+ * Releases the resources allocated for calibration
+ */
+void calib_destroy(struct calib *cal)
+{
+	free(cal->cbtns);
+}
+
+/*
+ * Loads saved offsets, one line of "dr dth" per button.  A missing file is
+ * not an error; a file for a different layout is ignored.
+ */
+int calib_load(struct calib *cal, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : 1;
+
+	struct calib_btn *loaded = calloc(cal->nbtns, sizeof(loaded[0]));
+	if (!loaded) {
+		fclose(f);
+		return 1;
+	}
+
+	int i, n = 0;
+	while (n <= cal->nbtns) {
+		double dr, dth;
+		if (fscanf(f, "%lf %lf", &dr, &dth) != 2)
+			break;
+		if (n < cal->nbtns)
+			loaded[n] = (struct calib_btn) {.dr = dr, .dth = dth};
+		n++;
+	}
+	fclose(f);
+
+	if (n != cal->nbtns) {
+		fprintf(stderr, "Ignoring calibration for a different layout\n");
+		free(loaded);
+		return 0;
+	}
+
+	for (i = 0; i < cal->nbtns; i++) {
+		cal->cbtns[i] = loaded[i];
+		clamp_btn(&cal->cbtns[i]);
+		apply_btn(cal, i);
+	}
+	free(loaded);
+	return 0;
+}
+
+/*
+ * Saves the learned offsets
+ */
+int calib_save(const struct calib *cal, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	int i;
+	for (i = 0; i < cal->nbtns; i++)
+		fprintf(f, "%.3f %.3f\n", cal->cbtns[i].dr, cal->cbtns[i].dth);
+	return fclose(f) != 0;
+}
+
+/*
+ * Folds one touch into its button's running offset.  Hits pull the offset
+ * toward where the touch landed; misses push it away.
+ */
+static void learn(struct calib *cal, const struct calib_touch *t, int miss)
+{
+	struct layout_btn *btn = &cal->btns[t->btn];
+	struct calib_btn *cb = &cal->cbtns[t->btn];
+
+	double r = hypot(t->x - btn->cx, btn->cy - t->y);
+	double th = 64 * 180 * atan2(btn->cy - t->y, t->x - btn->cx) / M_PI;
+	double dr = r - (btn->r1 + btn->r2) / 2.0;
+	double dth = th - (btn->th + btn->dth / 2.0);
+
+	if (miss) {
+		cb->dr -= CALIB_MISS_RATE * (dr - cb->dr);
+		cb->dth -= CALIB_MISS_RATE * (dth - cb->dth);
+	} else {
+		cb->dr += CALIB_HIT_RATE * (dr - cb->dr);
+		cb->dth += CALIB_HIT_RATE * (dth - cb->dth);
+	}
+	clamp_btn(cb);
+	apply_btn(cal, t->btn);
+}
+
+/*
+ * Records the touches making up a committed chord.  The previous chord's
+ * touches are learned as misses if this chord undoes it quickly, and as hits
+ * otherwise.  Undo chords themselves are not learned.
+ */
+void calib_chord(struct calib *cal, const struct calib_touch *touches, int n,
+		int undo, unsigned long time)
+{
+	int miss = undo && time - cal->pending_time <= CALIB_MISS_MS;
+	int i;
+	for (i = 0; i < cal->npending; i++)
+		learn(cal, &cal->pending[i], miss);
+	cal->npending = 0;
+
+	if (undo)
+		return;
+
+	if (n > CALIB_MAX_TOUCHES)
+		n = CALIB_MAX_TOUCHES;
+	memcpy(cal->pending, touches, n * sizeof(touches[0]));
+	cal->npending = n;
+	cal->pending_time = time;
+}
@@ -0,0 +1,58 @@
+#ifndef CALIB_H_
+#define CALIB_H_
+
+// Most touches remembered from a single chord
+#define CALIB_MAX_TOUCHES 16
+
+// A chord undone within this many milliseconds is treated as a miss
+#define CALIB_MISS_MS 1500
+
+// Learning rates for touches in accepted and undone chords
+#define CALIB_HIT_RATE 0.05
+#define CALIB_MISS_RATE 0.02
+
+struct layout_btn;
+
+/*
+ * Learned touch offset for one button, relative to the center of its arc
+ */
+struct calib_btn {
+	// Running mean of touch position (radius in pixels, angle in 1/64ths
+	// of degrees)
+	double dr, dth;
+};
+
+/*
+ * Touch that contributed to a chord, for calibration
+ */
+struct calib_touch {
+	int btn;
+	double x, y;
+};
+
+/*
+ * Online calibration state for the hit regions of a layout
+ */
+struct calib {
+	struct layout_btn *btns;
+	struct calib_btn *cbtns;
+	int nbtns;
+
+	// Touches from the last chord, held back until we know whether it was
+	// undone
+	struct calib_touch pending[CALIB_MAX_TOUCHES];
+	int npending;
+	unsigned long pending_time;
+};
+
+int calib_init(struct calib *cal, struct layout_btn *btns, int nbtns);
+void calib_destroy(struct calib *cal);
+void calib_apply(struct calib *cal);
+
+int calib_load(struct calib *cal, const char *path);
+int calib_save(const struct calib *cal, const char *path);
+
+void calib_chord(struct calib *cal, const struct calib_touch *touches, int n,
+		int undo, unsigned long time);
+
+#endif
@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <X11/keysym.h>
 
 #include "chorder.h"
 
@@ -64,6 +66,42 @@ static int removemod(struct mod_stack **mods, unsigned long code)
 	return 0;
 }
 
+/*
+ * Resets the state of a chorder whose keymap has been set up
+ */
+static int init_state(struct chorder *kbd, chorder_handler_t press, void *arg)
+{
+	unsigned long i;
+
+	kbd->long_entries = NULL;
+	kbd->long_ms = malloc(kbd->maps * sizeof(*kbd->long_ms));
+	if (!kbd->long_ms) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < kbd->maps; i++)
+		kbd->long_ms[i] = CHORDER_LONG_MS;
+
+	kbd->current_map = 0;
+	kbd->mods = NULL;
+	kbd->lockmods = NULL;
+	kbd->macromods = NULL;
+	kbd->macrolocks = NULL;
+	kbd->counts = NULL;
+	kbd->journal_head = 0;
+	kbd->journal_len = 0;
+	kbd->arena = NULL;
+	kbd->arena_size = 0;
+	kbd->arena_used = 0;
+	kbd->rec_start = 0;
+	kbd->press = press;
+	kbd->arg = arg;
+	kbd->maplock = 0;
+	kbd->recording = 0;
+	kbd->binding = 0;
+	return 0;
+}
+
 /*
  * Initializes a chorder
  */
@@ -81,16 +119,161 @@ int chorder_init(struct chorder *kbd, const struct chord_entry *entries,
 
 	kbd->maps = maps;
 	kbd->entries_per_map = entries_per_map;
-	kbd->current_map = 0;
-	kbd->mods = NULL;
-	kbd->lockmods = NULL;
-	kbd->macromods = NULL;
-	kbd->macrolocks = NULL;
-	kbd->press = press;
-	kbd->arg = arg;
-	kbd->maplock = 0;
+	kbd->nentries = maps * entries_per_map;
+	kbd->codes = NULL;
+	kbd->map_start = NULL;
+	if (init_state(kbd, press, arg)) {
+		free(kbd->entries);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Orders bindings by map, then by chord code
+ */
+static int cmp_binding(const void *a, const void *b)
+{
+	const struct chord_binding *x = a, *y = b;
+	if (x->map != y->map)
+		return x->map < y->map ? -1 : 1;
+	if (x->code != y->code)
+		return x->code < y->code ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sets up long-press variants from a list of bindings, if any has one.  For
+ * sparse keymaps the bindings must be in the same order as the entries.
+ */
+static int set_long_bindings(struct chorder *kbd,
+		const struct chord_binding *bindings, unsigned long nbindings)
+{
+	unsigned long i;
+
+	for (i = 0; i < nbindings; i++)
+		if (bindings[i].long_entry.type != TYPE_NONE)
+			break;
+	if (i == nbindings)
+		return 0;
+
+	kbd->long_entries = calloc(kbd->nentries, sizeof(*kbd->long_entries));
+	if (!kbd->long_entries) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nbindings; i++) {
+		unsigned long idx = kbd->codes ? i :
+			bindings[i].map * kbd->entries_per_map +
+			bindings[i].code;
+		kbd->long_entries[idx] = bindings[i].long_entry;
+	}
+	return 0;
+}
+
+/*
+ * Initializes a chorder from a list of the populated chords only.  Chords
+ * which are not bound behave as TYPE_NONE.  Small code spaces are expanded
+ * into a dense table; larger ones are kept as a sorted array per map so the
+ * keymap stays proportional to the number of bindings.
+ */
+int chorder_init_sparse(struct chorder *kbd,
+		const struct chord_binding *bindings, unsigned long nbindings,
+		unsigned long maps, unsigned int code_bits,
+		chorder_handler_t press, void *arg)
+{
+	unsigned long i;
+
+	if (code_bits > 32) {
+		fprintf(stderr, "chorder: chord codes wider than 32 bits\n");
+		return 1;
+	}
+	for (i = 0; i < nbindings; i++) {
+		if (bindings[i].map >= maps || (code_bits < 32 &&
+					bindings[i].code >> code_bits)) {
+			fprintf(stderr, "chorder: binding %lu out of range\n", i);
+			return 1;
+		}
+	}
+
+	// Dense fast path for small layouts
+	if (code_bits <= CHORDER_DENSE_BITS) {
+		unsigned long per_map = 1UL << code_bits;
+		kbd->entries = calloc(maps * per_map, sizeof(*kbd->entries));
+		if (!kbd->entries) {
+			perror("calloc");
+			return 1;
+		}
+		for (i = 0; i < nbindings; i++)
+			kbd->entries[bindings[i].map * per_map +
+				bindings[i].code] = bindings[i].entry;
+
+		kbd->maps = maps;
+		kbd->entries_per_map = per_map;
+		kbd->nentries = maps * per_map;
+		kbd->codes = NULL;
+		kbd->map_start = NULL;
+		if (init_state(kbd, press, arg)) {
+			free(kbd->entries);
+			return 1;
+		}
+		if (set_long_bindings(kbd, bindings, nbindings)) {
+			free(kbd->long_ms);
+			free(kbd->entries);
+			return 1;
+		}
+		return 0;
+	}
+
+	// Sort a copy of the bindings so each map is a contiguous run
+	struct chord_binding *sorted = malloc(nbindings * sizeof(*sorted));
+	kbd->entries = malloc(nbindings * sizeof(*kbd->entries));
+	kbd->codes = malloc(nbindings * sizeof(*kbd->codes));
+	kbd->map_start = malloc((maps + 1) * sizeof(*kbd->map_start));
+	if ((nbindings && (!sorted || !kbd->entries || !kbd->codes)) ||
+			!kbd->map_start) {
+		perror("malloc");
+		goto err;
+	}
+	memcpy(sorted, bindings, nbindings * sizeof(*sorted));
+	qsort(sorted, nbindings, sizeof(*sorted), cmp_binding);
 
+	unsigned long map = 0;
+	kbd->map_start[0] = 0;
+	for (i = 0; i < nbindings; i++) {
+		if (i > 0 && !cmp_binding(&sorted[i - 1], &sorted[i])) {
+			fprintf(stderr, "chorder: chord %#lx bound twice in map %u\n",
+					(unsigned long) sorted[i].code,
+					sorted[i].map);
+			goto err;
+		}
+		while (map < sorted[i].map)
+			kbd->map_start[++map] = i;
+		kbd->codes[i] = sorted[i].code;
+		kbd->entries[i] = sorted[i].entry;
+	}
+	while (map < maps)
+		kbd->map_start[++map] = nbindings;
+
+	kbd->maps = maps;
+	kbd->entries_per_map = 0;
+	kbd->nentries = nbindings;
+	if (init_state(kbd, press, arg))
+		goto err;
+	if (set_long_bindings(kbd, sorted, nbindings)) {
+		free(kbd->long_ms);
+		goto err;
+	}
+	free(sorted);
 	return 0;
+
+err:
+	free(sorted);
+	free(kbd->entries);
+	free(kbd->codes);
+	free(kbd->map_start);
+	return 1;
 }
 
 /*
@@ -113,6 +296,185 @@ void chorder_destroy(struct chorder *kbd)
 		kbd->press(kbd->arg, code, 0);
 
 	free(kbd->entries);
+	free(kbd->codes);
+	free(kbd->map_start);
+	free(kbd->long_entries);
+	free(kbd->long_ms);
+	free(kbd->arena);
+	free(kbd->counts);
+}
+
+/*
+ * Sets the long-press variants of every entry, given in the same layout as
+ * the entries passed to chorder_init
+ */
+int chorder_set_long(struct chorder *kbd, const struct chord_entry *entries)
+{
+	if (!kbd->long_entries) {
+		kbd->long_entries = malloc(kbd->nentries *
+				sizeof(*kbd->long_entries));
+		if (!kbd->long_entries) {
+			perror("malloc");
+			return 1;
+		}
+	}
+
+	memcpy(kbd->long_entries, entries,
+			kbd->nentries * sizeof(*kbd->long_entries));
+	return 0;
+}
+
+/*
+ * Enables macro recording, setting aside room for the given number of
+ * recorded entries up front
+ */
+int chorder_init_macros(struct chorder *kbd, unsigned long size)
+{
+	if (kbd->arena) {
+		fprintf(stderr, "chorder: macro arena already set up\n");
+		return 1;
+	}
+
+	kbd->arena = malloc(size * sizeof(*kbd->arena));
+	if (!kbd->arena) {
+		perror("malloc");
+		return 1;
+	}
+	kbd->arena_size = size;
+	kbd->arena_used = 0;
+	return 0;
+}
+
+/*
+ * Starts counting how often each entry fires
+ */
+int chorder_init_counts(struct chorder *kbd)
+{
+	if (!kbd->counts) {
+		kbd->counts = calloc(kbd->nentries, sizeof(*kbd->counts));
+		if (!kbd->counts) {
+			perror("calloc");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Finds the map and chord code of the entry at the given index
+ */
+void chorder_entry_chord(const struct chorder *kbd, unsigned long idx,
+		unsigned long *map, unsigned long *code)
+{
+	if (!kbd->codes) {
+		*map = idx / kbd->entries_per_map;
+		*code = idx % kbd->entries_per_map;
+		return;
+	}
+
+	for (*map = 0; kbd->map_start[*map + 1] <= idx; (*map)++)
+		;
+	*code = kbd->codes[idx];
+}
+
+/*
+ * Loads recorded macros, binding each to its chord if that chord is still
+ * unbound.  A missing file is not an error.
+ */
+int chorder_load_macros(struct chorder *kbd, const char *path)
+{
+	if (!kbd->arena) {
+		fprintf(stderr, "chorder: macro recording not enabled\n");
+		return 1;
+	}
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : 1;
+
+	// Each line is a map and chord followed by type:argument pairs, ending
+	// with the TYPE_NONE terminator.  A macro must do something, as
+	// recording never makes an empty one.
+	unsigned long map, code;
+	int rv = 0;
+	while (fscanf(f, "%lu %lx", &map, &code) == 2) {
+		unsigned long start = kbd->arena_used;
+		int type;
+		unsigned long arg;
+		do {
+			if (fscanf(f, " %d:%lx", &type, &arg) != 2 ||
+					(type != TYPE_NONE && type != TYPE_KEY &&
+					 type != TYPE_MOD &&
+					 type != TYPE_MODLOCK)) {
+				fprintf(stderr, "chorder: bad macro in %s\n",
+						path);
+				rv = 1;
+				break;
+			}
+			if (kbd->arena_used >= kbd->arena_size) {
+				fprintf(stderr, "chorder: too many macros in %s\n",
+						path);
+				rv = 1;
+				break;
+			}
+			kbd->arena[kbd->arena_used++] = (struct chord_entry) {
+				.type = type,
+				.arg.code = arg,
+			};
+		} while (type != TYPE_NONE);
+		if (!rv && kbd->arena_used - start < 2) {
+			fprintf(stderr, "chorder: empty macro in %s\n", path);
+			rv = 1;
+		}
+		if (rv) {
+			kbd->arena_used = start;
+			break;
+		}
+
+		struct chord_entry *e = chorder_get_entry(kbd, map, code);
+		if (!e || e->type != TYPE_NONE) {
+			fprintf(stderr, "chorder: chord %#lx in map %lu is taken, dropping its macro\n",
+					code, map);
+			kbd->arena_used = start;
+			continue;
+		}
+		*e = (struct chord_entry) {
+			.type = TYPE_MACRO,
+			.arg.ptr = kbd->arena + start,
+		};
+	}
+	fclose(f);
+	return rv;
+}
+
+/*
+ * Saves every recorded macro which is bound to a chord
+ */
+int chorder_save_macros(const struct chorder *kbd, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	unsigned long i;
+	for (i = 0; kbd->arena && i < kbd->nentries; i++) {
+		const struct chord_entry *macro = kbd->entries[i].arg.ptr;
+		if (kbd->entries[i].type != TYPE_MACRO ||
+				macro < kbd->arena ||
+				macro >= kbd->arena + kbd->arena_used)
+			continue;
+
+		unsigned long map, code;
+		chorder_entry_chord(kbd, i, &map, &code);
+		fprintf(f, "%lu %#lx", map, code);
+		do
+			fprintf(f, " %d:%#lx", macro->type, macro->arg.code);
+		while ((macro++)->type != TYPE_NONE);
+		fputc('\n', f);
+	}
+	return fclose(f) != 0;
 }
 
 /*
@@ -122,10 +484,260 @@ struct chord_entry *chorder_get_entry(const struct chorder *kbd,
 		unsigned long map, unsigned long entry)
 {
 	// Bounds checking
-	if (map >= kbd->maps || entry >= kbd->entries_per_map)
+	if (map >= kbd->maps)
 		return NULL;
 
-	return kbd->entries + map * kbd->entries_per_map + entry;
+	if (!kbd->codes) {
+		if (entry >= kbd->entries_per_map)
+			return NULL;
+		return kbd->entries + map * kbd->entries_per_map + entry;
+	}
+
+	// Binary search within the map's run of sorted codes
+	unsigned long lo = kbd->map_start[map], hi = kbd->map_start[map + 1];
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+		if (kbd->codes[mid] < entry)
+			lo = mid + 1;
+		else if (kbd->codes[mid] > entry)
+			hi = mid;
+		else
+			return kbd->entries + mid;
+	}
+	return NULL;
+}
+
+/*
+ * Gets the long-press variant of the given entry, or NULL if it has none
+ */
+struct chord_entry *chorder_get_long(const struct chorder *kbd,
+		unsigned long map, unsigned long entry)
+{
+	if (!kbd->long_entries)
+		return NULL;
+
+	struct chord_entry *e = chorder_get_entry(kbd, map, entry);
+	if (!e)
+		return NULL;
+
+	e = kbd->long_entries + (e - kbd->entries);
+	return e->type == TYPE_NONE ? NULL : e;
+}
+
+/*
+ * Starts recording a macro, or stops and waits for a chord to bind it to
+ */
+static void toggle_recording(struct chorder *kbd)
+{
+	if (!kbd->arena) {
+		fprintf(stderr, "chorder: macro recording not enabled\n");
+		return;
+	}
+
+	if (!kbd->recording) {
+		kbd->recording = 1;
+		kbd->rec_start = kbd->arena_used;
+		return;
+	}
+
+	kbd->recording = 0;
+	if (kbd->arena_used == kbd->rec_start)
+		return;
+	kbd->arena[kbd->arena_used++] = (struct chord_entry) {.type = TYPE_NONE};
+	kbd->binding = 1;
+}
+
+/*
+ * Appends what a chord does to the macro being recorded.  Map selections are
+ * left out, since they only decide which entries come after them.  Running
+ * out of arena abandons the recording.
+ */
+static void record_entry(struct chorder *kbd, const struct chord_entry *e)
+{
+	const struct chord_entry *src = e;
+	unsigned long n = 1;
+
+	switch (e->type) {
+		case TYPE_KEY:
+		case TYPE_MOD:
+		case TYPE_MODLOCK:
+			break;
+		case TYPE_MACRO:
+			src = e->arg.ptr;
+			for (n = 0; src[n].type != TYPE_NONE; n++)
+				;
+			break;
+		default:
+			return;
+	}
+
+	// Always leave room for the terminator
+	if (kbd->arena_size - kbd->arena_used <= n) {
+		fprintf(stderr, "chorder: macro arena full, recording abandoned\n");
+		kbd->recording = 0;
+		kbd->arena_used = kbd->rec_start;
+		return;
+	}
+	memcpy(kbd->arena + kbd->arena_used, src, n * sizeof(*src));
+	kbd->arena_used += n;
+}
+
+/*
+ * Copies up to CHORDER_JOURNAL_MODS codes from a mod stack, returning 1 if
+ * there were too many
+ */
+static int save_mods(const struct mod_stack *mods, unsigned long *codes,
+		unsigned int *n)
+{
+	for (*n = 0; mods; mods = mods->next) {
+		if (*n >= CHORDER_JOURNAL_MODS)
+			return 1;
+		codes[(*n)++] = mods->code;
+	}
+	return 0;
+}
+
+/*
+ * Starts a journal record for a chord, dropping the oldest if the ring is
+ * full
+ */
+static void journal_begin(struct chorder *kbd)
+{
+	if (kbd->journal_len == CHORDER_JOURNAL_LEN) {
+		kbd->journal_head = (kbd->journal_head + 1) % CHORDER_JOURNAL_LEN;
+		kbd->journal_len--;
+	}
+
+	struct chord_record *r = &kbd->journal[(kbd->journal_head +
+			kbd->journal_len++) % CHORDER_JOURNAL_LEN];
+	r->map = kbd->current_map;
+	r->maplock = kbd->maplock;
+	r->arena_used = kbd->arena_used;
+	r->chars = 0;
+	r->irreversible = save_mods(kbd->mods, r->mods, &r->nmods) ||
+		save_mods(kbd->lockmods, r->locks, &r->nlocks);
+}
+
+/*
+ * Returns 1 if a stack holds nothing but Shift
+ */
+static int only_shift(const struct mod_stack *mods)
+{
+	for (/* mods */; mods; mods = mods->next)
+		if (mods->code != XK_Shift_L && mods->code != XK_Shift_R)
+			return 0;
+	return 1;
+}
+
+/*
+ * Returns 1 if a keysym only inserts text, so that BackSpace takes it back.
+ * Return and Tab don't count: in terminals, shells and forms they submit or
+ * move the focus.
+ */
+int chorder_is_text(unsigned long sym)
+{
+	return (sym >= XK_space && sym <= XK_ydiaeresis) ||
+		(sym >= 0x1000100 && sym <= 0x110ffff);
+}
+
+/*
+ * Notes a key typed by the chord being journaled.  Keys which insert text
+ * can be taken back with BackSpace; anything else, or any key pressed with a
+ * modifier other than Shift, makes the chord irreversible.
+ */
+static void journal_key(struct chorder *kbd, unsigned long sym)
+{
+	if (!kbd->journal_len)
+		return;
+
+	struct chord_record *r = &kbd->journal[(kbd->journal_head +
+			kbd->journal_len - 1) % CHORDER_JOURNAL_LEN];
+	if (chorder_is_text(sym) && only_shift(kbd->mods) && only_shift(kbd->lockmods) &&
+			only_shift(kbd->macromods) &&
+			only_shift(kbd->macrolocks))
+		r->chars++;
+	else
+		r->irreversible = 1;
+}
+
+/*
+ * Returns 1 if the given mod was held or locked when a record was taken
+ */
+static int record_has_mod(const struct chord_record *r, unsigned long code)
+{
+	unsigned int i;
+	for (i = 0; i < r->nmods; i++)
+		if (r->mods[i] == code)
+			return 1;
+	for (i = 0; i < r->nlocks; i++)
+		if (r->locks[i] == code)
+			return 1;
+	return 0;
+}
+
+/*
+ * Puts the mod stacks back the way a record found them, pressing and
+ * releasing only the mods whose state differs
+ */
+static int restore_mods(struct chorder *kbd, const struct chord_record *r)
+{
+	unsigned long code;
+	unsigned int i;
+
+	for (i = 0; i < r->nmods + r->nlocks; i++) {
+		code = i < r->nmods ? r->mods[i] : r->locks[i - r->nmods];
+		if (!hasmod(kbd->mods, code) && !hasmod(kbd->lockmods, code))
+			kbd->press(kbd->arg, code, 1);
+	}
+	while ((code = popmod(&kbd->mods)))
+		if (!record_has_mod(r, code))
+			kbd->press(kbd->arg, code, 0);
+	while ((code = popmod(&kbd->lockmods)))
+		if (!record_has_mod(r, code))
+			kbd->press(kbd->arg, code, 0);
+
+	// Push in reverse to keep the original stack order
+	for (i = r->nmods; i-- > 0; )
+		if (pushmod(&kbd->mods, r->mods[i]))
+			return 1;
+	for (i = r->nlocks; i-- > 0; )
+		if (pushmod(&kbd->lockmods, r->locks[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Takes back the output of the last chord in the journal: the characters it
+ * typed are erased together, then its mod and map changes are reversed.
+ */
+static int undo_chord(struct chorder *kbd)
+{
+	if (!kbd->journal_len) {
+		fprintf(stderr, "chorder: nothing to undo\n");
+		return 0;
+	}
+
+	struct chord_record *r = &kbd->journal[(kbd->journal_head +
+			--kbd->journal_len) % CHORDER_JOURNAL_LEN];
+	if (r->irreversible) {
+		fprintf(stderr, "chorder: last chord cannot be undone\n");
+		return 0;
+	}
+
+	// Erase first, while at most Shift can be held
+	unsigned int i;
+	for (i = 0; i < r->chars; i++) {
+		kbd->press(kbd->arg, XK_BackSpace, 1);
+		kbd->press(kbd->arg, XK_BackSpace, 0);
+	}
+	if (restore_mods(kbd, r))
+		return 1;
+
+	kbd->current_map = r->map;
+	kbd->maplock = r->maplock;
+	if (kbd->recording && r->arena_used >= kbd->rec_start)
+		kbd->arena_used = r->arena_used;
+	return 0;
 }
 
 /*
@@ -144,6 +756,7 @@ static int handle_entry(struct chorder *kbd, struct chord_entry *e, int in_macro
 			break;
 		case TYPE_KEY:
 			arg = e->arg.code;
+			journal_key(kbd, arg);
 			// Until there's a nice way to handle it, holding
 			// regular keys is not supported
 			kbd->press(kbd->arg, arg, 1);
@@ -275,21 +888,60 @@ static int handle_entry(struct chorder *kbd, struct chord_entry *e, int in_macro
 				fprintf(stderr, "chorder: nested macros are not supported\n");
 				return 1;
 			}
-			// Handle each entry in turn
+			// Handle each entry in turn, stopping at the first
+			// which fails
+			rv = 0;
 			for (macro = e->arg.ptr; macro->type != TYPE_NONE; macro++) {
 				rv = handle_entry(kbd, macro, 1);
 				if (rv)
-					return rv;
+					break;
 			}
 			// When the macro finishes, propagate any new mods to
 			// the outside state
 			// XXX Yes, this messes up the stack-ordering of the
 			// mods.  Does that matter?
-			while ((code = popmod(&kbd->macromods)))
-				pushmod(&kbd->mods, code);
-			while ((code = popmod(&kbd->macrolocks)))
-				pushmod(&kbd->lockmods, code);
+			// Mods already down outside were never pressed by
+			// the macro, so they are not pushed a second time, and
+			// a mod the macro locked is no longer merely held.
+			// Both stacks are drained even if an entry or a push
+			// failed, so no later macro inherits them, and a mod
+			// which can't be tracked is released rather than left
+			// down.
+			while ((code = popmod(&kbd->macromods))) {
+				if (hasmod(kbd->mods, code) ||
+						hasmod(kbd->lockmods, code))
+					continue;
+				if (pushmod(&kbd->mods, code)) {
+					kbd->press(kbd->arg, code, 0);
+					rv = 1;
+				}
+			}
+			while ((code = popmod(&kbd->macrolocks))) {
+				removemod(&kbd->mods, code);
+				if (hasmod(kbd->lockmods, code))
+					continue;
+				if (pushmod(&kbd->lockmods, code)) {
+					kbd->press(kbd->arg, code, 0);
+					rv = 1;
+				}
+			}
+			if (rv)
+				return rv;
+			break;
+		case TYPE_RECORD:
+			if (in_macro) {
+				fprintf(stderr, "chorder: macros cannot record macros\n");
+				return 1;
+			}
+			toggle_recording(kbd);
 			break;
+		case TYPE_UNDO:
+			if (in_macro) {
+				fprintf(stderr, "chorder: macros cannot undo\n");
+				return 1;
+			}
+			// Leaves the map as it was before the undone chord
+			return undo_chord(kbd);
 	}
 
 	// Switch back to default map if it wasn't just set and isn't locked
@@ -298,8 +950,139 @@ static int handle_entry(struct chorder *kbd, struct chord_entry *e, int in_macro
 	return 0;
 }
 
+/*
+ * Grows one of the arrays indexed like the entries by one element, moving
+ * those from idx on up to make room at idx.  Returns 1 if out of memory.
+ */
+static int insert_at(void **array, size_t size, unsigned long n,
+		unsigned long idx)
+{
+	char *p = realloc(*array, (n + 1) * size);
+	if (!p) {
+		perror("realloc");
+		return 1;
+	}
+	memmove(p + (idx + 1) * size, p + idx * size, (n - idx) * size);
+	memset(p + idx * size, 0, size);
+	*array = p;
+	return 0;
+}
+
+/*
+ * Adds an empty binding for a chord to a sparse keymap, keeping the map's
+ * codes sorted.  Returns the new entry, or NULL if it could not be added.
+ */
+static struct chord_entry *insert_binding(struct chorder *kbd,
+		unsigned long map, unsigned long code)
+{
+	unsigned long n = kbd->nentries, idx, m;
+
+	if (!kbd->codes || map >= kbd->maps || code > UINT32_MAX)
+		return NULL;
+	for (idx = kbd->map_start[map]; idx < kbd->map_start[map + 1] &&
+			kbd->codes[idx] < code; idx++)
+		;
+
+	// Every array indexed like the entries grows together; one which has
+	// grown alone is merely larger than it needs to be
+	if (insert_at((void **) &kbd->entries, sizeof(*kbd->entries), n,
+				idx) ||
+			insert_at((void **) &kbd->codes, sizeof(*kbd->codes),
+				n, idx) ||
+			(kbd->long_entries && insert_at(
+				(void **) &kbd->long_entries,
+				sizeof(*kbd->long_entries), n, idx)) ||
+			(kbd->counts && insert_at((void **) &kbd->counts,
+				sizeof(*kbd->counts), n, idx)))
+		return NULL;
+
+	kbd->codes[idx] = code;
+	for (m = map + 1; m <= kbd->maps; m++)
+		kbd->map_start[m]++;
+	kbd->nentries++;
+	return &kbd->entries[idx];
+}
+
+/*
+ * Handles a chord while a finished recording waits to be bound.  Map chords
+ * work as usual so the macro may go in any map.  The macro is bound to the
+ * first unbound chord (e is NULL if the chord has no entry at all); any other
+ * chord discards it.
+ */
+static int assign_recording(struct chorder *kbd, struct chord_entry *e)
+{
+	if (e && (e->type == TYPE_MAP || e->type == TYPE_MAPLOCK))
+		return handle_entry(kbd, e, 0);
+
+	kbd->binding = 0;
+	if (e && e->type == TYPE_NONE) {
+		*e = (struct chord_entry) {
+			.type = TYPE_MACRO,
+			.arg.ptr = kbd->arena + kbd->rec_start,
+		};
+	} else {
+		fprintf(stderr, "chorder: no free slot, macro discarded\n");
+		kbd->arena_used = kbd->rec_start;
+	}
+
+	if (!kbd->maplock)
+		kbd->current_map = 0;
+	return 0;
+}
+
+/*
+ * Handles an entry at the top level, journaling and recording it if need be
+ */
+static int press_entry(struct chorder *kbd, struct chord_entry *e)
+{
+	if (e->type != TYPE_NONE && e->type != TYPE_RECORD &&
+			e->type != TYPE_UNDO)
+		journal_begin(kbd);
+	if (kbd->recording)
+		record_entry(kbd, e);
+	return handle_entry(kbd, e, 0);
+}
+
 int chorder_press(struct chorder *kbd, unsigned long entry)
 {
+	static struct chord_entry unmapped = {.type = TYPE_NONE};
 	struct chord_entry *e = chorder_get_entry(kbd, kbd->current_map, entry);
-	return handle_entry(kbd, e, 0);
+	if (kbd->binding) {
+		// Sparse keymaps only have entries for bound chords, so one
+		// is made for the macro
+		if (!e)
+			e = insert_binding(kbd, kbd->current_map, entry);
+		return assign_recording(kbd, e);
+	}
+	if (!e)
+		e = &unmapped;
+	else if (kbd->counts)
+		kbd->counts[e - kbd->entries]++;
+	return press_entry(kbd, e);
+}
+
+/*
+ * Handles a chord which was held long enough to select its long-press
+ * variant, falling back to the normal entry if there is none
+ */
+int chorder_press_long(struct chorder *kbd, unsigned long entry)
+{
+	struct chord_entry *e = chorder_get_long(kbd, kbd->current_map, entry);
+	if (!e)
+		return chorder_press(kbd, entry);
+	if (kbd->binding)
+		return assign_recording(kbd, e);
+	if (kbd->counts)
+		kbd->counts[e - kbd->long_entries]++;
+	return press_entry(kbd, e);
+}
+
+/*
+ * Handles an entry directly, as if a chord mapped to it had been pressed
+ */
+int chorder_press_entry(struct chorder *kbd, struct chord_entry *e)
+{
+	if (kbd->binding)
+		return assign_recording(kbd, NULL);
+	return press_entry(kbd, e);
 }
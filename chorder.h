@@ -1,6 +1,7 @@
 #ifndef CHORDER_H_
 #define CHORDER_H_
 
+#include <stdint.h>
 #include <X11/Xlib.h>
 
 typedef void (*chorder_handler_t)(void *arg, unsigned long code, int press);
@@ -21,6 +22,10 @@ enum chord_type {
 	TYPE_MAPLOCK,
 	// Executes a sequence of chord entries
 	TYPE_MACRO,
+	// Starts recording a macro, or stops and binds it to the next chord
+	TYPE_RECORD,
+	// Takes back the output of the last chord
+	TYPE_UNDO,
 };
 
 // Single entry in a keymap
@@ -33,18 +38,69 @@ struct chord_entry {
 	} arg;
 };
 
+// Chord codes up to this many bits wide are stored as a dense table
+#define CHORDER_DENSE_BITS 8
+
+// Default time (ms) a chord must be held to select its long variant
+#define CHORDER_LONG_MS 350
+
+// Default number of entries set aside for recorded macros
+#define CHORDER_ARENA_SIZE 1024
+
+// Number of chords remembered for undo, and most mods remembered with each
+#define CHORDER_JOURNAL_LEN 32
+#define CHORDER_JOURNAL_MODS 8
+
+// Binding of a chord code to an entry, used to build sparse keymaps
+struct chord_binding {
+	unsigned int map;
+	uint32_t code;
+	struct chord_entry entry;
+	// Action when the chord is held (TYPE_NONE if it has none)
+	struct chord_entry long_entry;
+};
+
 // Stack data structure for mod keys
 struct mod_stack {
 	unsigned long code;
 	struct mod_stack *next;
 };
 
+// What one chord did, so that it can be undone
+struct chord_record {
+	// Map selection and mods held and locked before the chord
+	unsigned long map;
+	unsigned long mods[CHORDER_JOURNAL_MODS];
+	unsigned long locks[CHORDER_JOURNAL_MODS];
+	unsigned int nmods, nlocks;
+	// Length of the macro being recorded before the chord
+	unsigned long arena_used;
+	// Characters the chord typed
+	unsigned int chars;
+	unsigned int maplock : 1;
+	// Whether the chord did something BackSpace can't take back, such as
+	// moving the cursor or pressing a key with a modifier other than Shift
+	unsigned int irreversible : 1;
+};
+
 struct chorder {
 	// Entries defining the keymap
 	struct chord_entry *entries;
-	// Number of keymaps and entries per map
+	// Number of keymaps and entries per map (0 if the keymap is sparse)
 	unsigned long maps;
 	unsigned long entries_per_map;
+	// Total number of entries in all maps
+	unsigned long nentries;
+
+	// For sparse keymaps, the sorted chord code of each entry and the
+	// index of the first entry in each map (NULL if the keymap is dense)
+	uint32_t *codes;
+	unsigned long *map_start;
+
+	// Long-press variant of each entry, indexed like entries (NULL if no
+	// entry has one), and the hold time in ms selecting them in each map
+	struct chord_entry *long_entries;
+	unsigned int *long_ms;
 
 	// Currently selected keymap
 	unsigned long current_map;
@@ -57,6 +113,23 @@ struct chorder {
 	struct mod_stack *macromods;
 	struct mod_stack *macrolocks;
 
+	// Arena holding recorded macros, each terminated by a TYPE_NONE entry
+	// (NULL if recording is not enabled), its size and how much is used,
+	// and where the macro being recorded starts
+	struct chord_entry *arena;
+	unsigned long arena_size;
+	unsigned long arena_used;
+	unsigned long rec_start;
+
+	// Number of times each entry has fired, indexed like entries (NULL if
+	// not counted).  A long-press variant counts toward its entry.
+	unsigned long *counts;
+
+	// Ring of the most recent chords, oldest first, for undo
+	struct chord_record journal[CHORDER_JOURNAL_LEN];
+	unsigned int journal_head;
+	unsigned int journal_len;
+
 	// Function to call when a key is pressed
 	chorder_handler_t press;
 	// Opaque pointer passed to the press handler
@@ -64,16 +137,38 @@ struct chorder {
 
 	// Flags
 	unsigned int maplock : 1;
+	// Whether committed chords are being recorded, and whether a finished
+	// recording is waiting for an unbound chord to be assigned to
+	unsigned int recording : 1;
+	unsigned int binding : 1;
 };
 
 int chorder_init(struct chorder *kbd, const struct chord_entry *map,
 		unsigned long maps, unsigned long entries_per_map,
 		chorder_handler_t handle, void *arg);
+int chorder_init_sparse(struct chorder *kbd,
+		const struct chord_binding *bindings, unsigned long nbindings,
+		unsigned long maps, unsigned int code_bits,
+		chorder_handler_t handle, void *arg);
 void chorder_destroy(struct chorder *kbd);
 
+int chorder_set_long(struct chorder *kbd, const struct chord_entry *entries);
+int chorder_init_macros(struct chorder *kbd, unsigned long size);
+int chorder_init_counts(struct chorder *kbd);
+int chorder_load_macros(struct chorder *kbd, const char *path);
+int chorder_save_macros(const struct chorder *kbd, const char *path);
+
 struct chord_entry *chorder_get_entry(const struct chorder *kbd,
 		unsigned long map, unsigned long entry);
+struct chord_entry *chorder_get_long(const struct chorder *kbd,
+		unsigned long map, unsigned long entry);
+void chorder_entry_chord(const struct chorder *kbd, unsigned long idx,
+		unsigned long *map, unsigned long *code);
+
+int chorder_is_text(unsigned long sym);
 
 int chorder_press(struct chorder *kbd, unsigned long entry);
+int chorder_press_long(struct chorder *kbd, unsigned long entry);
+int chorder_press_entry(struct chorder *kbd, struct chord_entry *e);
 
 #endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <assert.h>
+#include <X11/keysym.h>
 
 #include "chorder.h"
 
@@ -9,6 +10,15 @@ void mypress(void *unused, unsigned long code, int press)
 	printf("%c %s\n", (char) code, press ? "pressed" : "released");
 }
 
+// Net presses of each key, for checking that none is left down
+int held[128];
+
+void trackpress(void *unused, unsigned long code, int press)
+{
+	(void) unused;
+	held[code & 127] += press ? 1 : -1;
+}
+
 struct chord_entry hello[] = {
 	{.type = TYPE_MOD, .arg.code = 'a'},
 	{.type = TYPE_MOD, .arg.code = 'a'},
@@ -21,6 +31,60 @@ struct chord_entry hello[] = {
 	{.type = TYPE_NONE},
 };
 
+// Ten-button layout with chords spread over a 12-bit code space
+struct chord_binding wide[] = {
+	{.map = 0, .code = 0x801, .entry = {.type = TYPE_KEY, .arg.code = 'w'}},
+	{.map = 0, .code = 0x001, .entry = {.type = TYPE_KEY, .arg.code = 'x'},
+		.long_entry = {.type = TYPE_KEY, .arg.code = 'X'}},
+	{.map = 0, .code = 0x3ff, .entry = {.type = TYPE_MAP, .arg.map = 1}},
+	{.map = 1, .code = 0x801, .entry = {.type = TYPE_KEY, .arg.code = 'W'}},
+};
+
+// Three-button layout with chords to record macros and undo
+struct chord_binding rec[] = {
+	{.code = 1, .entry = {.type = TYPE_KEY, .arg.code = 'r'}},
+	{.code = 2, .entry = {.type = TYPE_MOD, .arg.code = XK_Shift_L}},
+	{.code = 3, .entry = {.type = TYPE_RECORD}},
+	{.code = 4, .entry = {.type = TYPE_UNDO}},
+};
+
+// Macro pressing mods which are already held or locked outside it
+struct chord_entry shiftctl[] = {
+	{.type = TYPE_MOD, .arg.code = 'S'},
+	{.type = TYPE_MOD, .arg.code = 'C'},
+	{.type = TYPE_NONE},
+};
+struct chord_binding outside[] = {
+	{.code = 1, .entry = {.type = TYPE_MOD, .arg.code = 'S'}},
+	{.code = 2, .entry = {.type = TYPE_MODLOCK, .arg.code = 'C'}},
+	{.code = 3, .entry = {.type = TYPE_MACRO, .arg.ptr = shiftctl}},
+	{.code = 4, .entry = {.type = TYPE_KEY, .arg.code = 'x'}},
+};
+
+// Macros which do nothing, and which fail partway after pressing a mod
+struct chord_entry empty[] = {
+	{.type = TYPE_NONE},
+};
+struct chord_entry broken[] = {
+	{.type = TYPE_MOD, .arg.code = 'S'},
+	{.type = TYPE_MAP, .arg.map = 0},
+	{.type = TYPE_KEY, .arg.code = 'k'},
+	{.type = TYPE_NONE},
+};
+struct chord_binding failing[] = {
+	{.code = 1, .entry = {.type = TYPE_MACRO, .arg.ptr = empty}},
+	{.code = 2, .entry = {.type = TYPE_MACRO, .arg.ptr = broken}},
+	{.code = 3, .entry = {.type = TYPE_KEY, .arg.code = 'x'}},
+};
+
+// Wide layout recording macros, where unbound chords have no entry
+struct chord_binding wide_rec[] = {
+	{.code = 0x001, .entry = {.type = TYPE_KEY, .arg.code = 'r'},
+		.long_entry = {.type = TYPE_KEY, .arg.code = 'R'}},
+	{.code = 0x800, .entry = {.type = TYPE_RECORD}},
+	{.map = 1, .code = 0x001, .entry = {.type = TYPE_KEY, .arg.code = 's'}},
+};
+
 int main()
 {
 	int rv;
@@ -70,5 +134,166 @@ int main()
 	chorder_press(&kbd, 14);
 	// releases locked mod E
 	chorder_destroy(&kbd);
+
+	// Sparse keymap
+	rv = chorder_init_sparse(&kbd, wide, sizeof(wide)/sizeof(wide[0]),
+			2, 12, mypress, NULL);
+	assert(!rv);
+	assert(kbd.nentries == 4);
+	assert(chorder_get_entry(&kbd, 0, 0x801)->arg.code == 'w');
+	assert(chorder_get_entry(&kbd, 1, 0x801)->arg.code == 'W');
+	assert(!chorder_get_entry(&kbd, 1, 0x001));
+	assert(!chorder_get_entry(&kbd, 2, 0x801));
+	assert(chorder_get_long(&kbd, 0, 0x001)->arg.code == 'X');
+	assert(!chorder_get_long(&kbd, 0, 0x801));
+	// (map 0) key: x
+	chorder_press(&kbd, 0x001);
+	// (map 0) long key: X
+	chorder_press_long(&kbd, 0x001);
+	// (map 0) long falls back to key: w
+	chorder_press_long(&kbd, 0x801);
+	// (map 0) unmapped
+	chorder_press(&kbd, 0x002);
+	// (map 0) map: 1
+	chorder_press(&kbd, 0x3ff);
+	// (map 1) key: W
+	chorder_press(&kbd, 0x801);
+	chorder_destroy(&kbd);
+
+	// Narrow codes take the dense path
+	rv = chorder_init_sparse(&kbd, wide + 1, 1, 1, 6, mypress, NULL);
+	assert(!rv);
+	assert(!kbd.codes && kbd.entries_per_map == 64);
+	assert(chorder_get_entry(&kbd, 0, 1)->arg.code == 'x');
+	assert(chorder_get_entry(&kbd, 0, 2)->type == TYPE_NONE);
+	assert(chorder_get_long(&kbd, 0, 1)->arg.code == 'X');
+	assert(!chorder_get_long(&kbd, 0, 2));
+	chorder_destroy(&kbd);
+
+	// Record a macro and bind it to the free chord
+	rv = chorder_init_sparse(&kbd, rec, sizeof(rec)/sizeof(rec[0]),
+			1, 3, mypress, NULL);
+	assert(!rv);
+	rv = chorder_init_macros(&kbd, 8);
+	assert(!rv);
+	rv = chorder_init_counts(&kbd);
+	assert(!rv);
+	// (map 0) start recording
+	chorder_press(&kbd, 3);
+	// (map 0) mod: Shift
+	chorder_press(&kbd, 2);
+	// (map 0) key: r
+	chorder_press(&kbd, 1);
+	// (map 0) stop recording
+	chorder_press(&kbd, 3);
+	// (map 0) bind macro
+	chorder_press(&kbd, 0);
+	assert(chorder_get_entry(&kbd, 0, 0)->type == TYPE_MACRO);
+	assert(kbd.arena_used == 3);
+	// (map 0) macro: MOD(Shift) r
+	chorder_press(&kbd, 0);
+	// (map 0) undo: BackSpace
+	chorder_press(&kbd, 4);
+	// (map 0) mod: Shift
+	chorder_press(&kbd, 2);
+	// (map 0) undo: releases Shift
+	chorder_press(&kbd, 4);
+	assert(!kbd.mods);
+	// (map 0) undo: BackSpace for the r recorded earlier
+	chorder_press(&kbd, 4);
+	assert(kbd.journal_len == 1);
+	assert(kbd.counts[0] == 1 && kbd.counts[4] == 3);
+	chorder_destroy(&kbd);
+
+	// Return and Tab submit or move focus, so BackSpace can't undo them
+	assert(chorder_is_text('r') && chorder_is_text(0x10020ac));
+	assert(!chorder_is_text(XK_Return) && !chorder_is_text(XK_Tab));
+
+	// Record a macro on a sparse keymap, binding it to a chord which has
+	// no entry yet
+	rv = chorder_init_sparse(&kbd, wide_rec,
+			sizeof(wide_rec)/sizeof(wide_rec[0]), 2, 12, mypress,
+			NULL);
+	assert(!rv && kbd.codes);
+	rv = chorder_init_macros(&kbd, 8);
+	assert(!rv);
+	rv = chorder_init_counts(&kbd);
+	assert(!rv);
+	// (map 0) start recording
+	chorder_press(&kbd, 0x800);
+	// (map 0) key: r
+	chorder_press(&kbd, 0x001);
+	// (map 0) stop recording
+	chorder_press(&kbd, 0x800);
+	// (map 0) bind macro to a new entry
+	chorder_press(&kbd, 0x400);
+	assert(kbd.nentries == 4);
+	assert(chorder_get_entry(&kbd, 0, 0x400)->type == TYPE_MACRO);
+	assert(chorder_get_entry(&kbd, 0, 0x800)->type == TYPE_RECORD);
+	assert(chorder_get_long(&kbd, 0, 0x001)->arg.code == 'R');
+	assert(!chorder_get_long(&kbd, 0, 0x400));
+	assert(chorder_get_entry(&kbd, 1, 0x001)->arg.code == 's');
+	assert(!chorder_get_entry(&kbd, 1, 0x400));
+	// (map 0) macro: r
+	chorder_press(&kbd, 0x400);
+	assert(kbd.counts[1] == 1 && kbd.counts[0] == 1);
+	chorder_destroy(&kbd);
+
+	// A macro's mods which were held or locked outside it stay as they
+	// were: held once, or locked and not also held
+	rv = chorder_init_sparse(&kbd, outside,
+			sizeof(outside)/sizeof(outside[0]), 1, 3, trackpress,
+			NULL);
+	assert(!rv);
+	// (map 0) mod: S
+	chorder_press(&kbd, 1);
+	// (map 0) modlock: C
+	chorder_press(&kbd, 2);
+	// (map 0) macro: MOD(S) MOD(C)
+	chorder_press(&kbd, 3);
+	assert(!kbd.macromods && !kbd.macrolocks);
+	assert(kbd.mods && kbd.mods->code == 'S' && !kbd.mods->next);
+	assert(kbd.lockmods && kbd.lockmods->code == 'C' &&
+			!kbd.lockmods->next);
+	assert(held['S'] == 1 && held['C'] == 1);
+	// (map 0) key: x, releasing S but not C
+	chorder_press(&kbd, 4);
+	assert(!kbd.mods && held['S'] == 0 && held['C'] == 1);
+	// releases locked mod C
+	chorder_destroy(&kbd);
+	for (i = 0; i < 128; i++)
+		assert(!held[i]);
+
+	// An empty macro does nothing and succeeds; one which fails partway
+	// still hands its mods over rather than leaving them to the next
+	rv = chorder_init_sparse(&kbd, failing,
+			sizeof(failing)/sizeof(failing[0]), 1, 2, trackpress,
+			NULL);
+	assert(!rv);
+	// (map 0) macro: nothing
+	assert(!chorder_press(&kbd, 1));
+	// (map 0) macro: MOD(S), then fails on MAP
+	assert(chorder_press(&kbd, 2));
+	assert(!kbd.macromods && !kbd.macrolocks);
+	assert(kbd.mods && kbd.mods->code == 'S' && held['S'] == 1);
+	assert(held['k'] == 0);
+	// (map 0) key: x, releasing S
+	chorder_press(&kbd, 3);
+	assert(!kbd.mods && held['S'] == 0);
+
+	// Empty macros are refused when loading
+	rv = chorder_init_macros(&kbd, 8);
+	assert(!rv);
+	FILE *f = fopen("chorder_test.macros", "w");
+	assert(f);
+	fprintf(f, "0 0x0 0:0x0\n");
+	fclose(f);
+	assert(chorder_load_macros(&kbd, "chorder_test.macros"));
+	remove("chorder_test.macros");
+	assert(kbd.arena_used == 0);
+	assert(chorder_get_entry(&kbd, 0, 0)->type == TYPE_NONE);
+	chorder_destroy(&kbd);
+	for (i = 0; i < 128; i++)
+		assert(!held[i]);
 	return 0;
 }
@@ -0,0 +1,396 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <X11/keysym.h>
+
+#include "chorder.h"
+
+/*
+ * Presses random chords on random keymaps and checks that the chorder never
+ * leaves a key stuck.  A shadow of the X server's key state catches any key
+ * pressed while already down or released while already up, any key down
+ * which the chorder no longer holds as a mod, and any key still down once
+ * the chorder is destroyed.  Each seed builds its own keymap, with mods,
+ * locks, map switches, macros, recording and undo, and seeds are shared out
+ * between threads.
+ */
+
+// Keymaps per seed, chords bound in each, and macros to choose from
+#define NMAPS 3
+#define NBINDINGS 24
+#define NMACROS 8
+#define MACRO_LEN 8
+// Recorded entries per seed, kept small so the arena fills up
+#define ARENA_SIZE 64
+
+// Keys typed, and mods held, by random entries
+static const unsigned long keys[] = {
+	'a', 'b', 'c', 'd', 'e', 'f', XK_Return, XK_Tab, XK_Left, XK_Delete,
+};
+static const unsigned long mods[] = {
+	XK_Shift_L, XK_Shift_R, XK_Control_L, XK_Alt_L, XK_Super_L,
+};
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+#define NMODS (sizeof(mods) / sizeof(mods[0]))
+
+/*
+ * Work for one thread, and the shadow key state of the seed it is on
+ */
+struct worker {
+	pthread_t tid;
+	unsigned long first, stride, end;
+	unsigned long presses;
+	uint64_t rng;
+
+	struct chorder kbd;
+	struct chord_binding bindings[NBINDINGS];
+	struct chord_entry macros[NMACROS][MACRO_LEN + 1];
+	// Keys down, indexed as gkos caches keycodes: Latin-1, then the
+	// 0xff00 page
+	unsigned char down[2][256];
+	unsigned int ndown;
+
+	// First failure seen, if any
+	unsigned long seed, step;
+	char error[128];
+};
+
+static unsigned long npresses = 1000000;
+static int failed;
+
+/*
+ * Returns a random number below n
+ */
+static unsigned long rnd(struct worker *w, unsigned long n)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return w->rng % n;
+}
+
+/*
+ * Notes the first failure of a seed
+ */
+static void fail(struct worker *w, const char *what, unsigned long code)
+{
+	if (w->error[0])
+		return;
+	const char *name = XKeysymToString(code);
+	snprintf(w->error, sizeof(w->error), "%s %s", what,
+			name ? name : "unknown key");
+}
+
+/*
+ * Finds a key's slot in the shadow state
+ */
+static unsigned char *key_slot(struct worker *w, unsigned long code)
+{
+	if (code <= 0xff)
+		return &w->down[0][code];
+	if ((code & ~0xffUL) == 0xff00)
+		return &w->down[1][code & 0xff];
+	return NULL;
+}
+
+/*
+ * Press handler which updates the shadow key state
+ */
+static void shadow_press(void *arg, unsigned long code, int press)
+{
+	struct worker *w = arg;
+	unsigned char *k = key_slot(w, code);
+	if (!k) {
+		fail(w, "unexpected key", code);
+		return;
+	}
+	if (*k == press) {
+		fail(w, press ? "double press of" : "double release of", code);
+		return;
+	}
+	*k = press;
+	if (press)
+		w->ndown++;
+	else
+		w->ndown--;
+}
+
+/*
+ * Returns 1 if a mod appears in a stack before the given node (NULL for the
+ * whole stack)
+ */
+static int in_stack(const struct mod_stack *s, const struct mod_stack *end,
+		unsigned long code)
+{
+	for (/* s */; s != end; s = s->next)
+		if (s->code == code)
+			return 1;
+	return 0;
+}
+
+/*
+ * Checks that a mod stack holds only keys which are down, returning how many
+ * different keys it holds which are not also in another stack
+ */
+static unsigned int check_stack(struct worker *w, const struct mod_stack *s,
+		const struct mod_stack *other)
+{
+	const struct mod_stack *node;
+	unsigned int n = 0;
+	for (node = s; node; node = node->next) {
+		unsigned char *k = key_slot(w, node->code);
+		if (!k || !*k) {
+			fail(w, "chorder holds released", node->code);
+			break;
+		}
+		if (!in_stack(s, node, node->code) &&
+				!in_stack(other, NULL, node->code))
+			n++;
+	}
+	return n;
+}
+
+/*
+ * Returns a random entry which may appear in a macro
+ */
+static struct chord_entry macro_entry(struct worker *w)
+{
+	switch (rnd(w, 4)) {
+		case 0:
+			return (struct chord_entry) {.type = TYPE_MOD,
+				.arg.code = mods[rnd(w, NMODS)]};
+		case 1:
+			return (struct chord_entry) {.type = TYPE_MODLOCK,
+				.arg.code = mods[rnd(w, NMODS)]};
+		default:
+			return (struct chord_entry) {.type = TYPE_KEY,
+				.arg.code = keys[rnd(w, NKEYS)]};
+	}
+}
+
+/*
+ * Returns a random keymap entry
+ */
+static struct chord_entry random_entry(struct worker *w)
+{
+	unsigned long r = rnd(w, 100);
+	if (r < 35)
+		return (struct chord_entry) {.type = TYPE_KEY,
+			.arg.code = keys[rnd(w, NKEYS)]};
+	if (r < 50)
+		return (struct chord_entry) {.type = TYPE_MOD,
+			.arg.code = mods[rnd(w, NMODS)]};
+	if (r < 58)
+		return (struct chord_entry) {.type = TYPE_MODLOCK,
+			.arg.code = mods[rnd(w, NMODS)]};
+	if (r < 66)
+		return (struct chord_entry) {.type = TYPE_MAP,
+			.arg.map = rnd(w, NMAPS)};
+	if (r < 71)
+		return (struct chord_entry) {.type = TYPE_MAPLOCK,
+			.arg.map = rnd(w, NMAPS)};
+	if (r < 83)
+		return (struct chord_entry) {.type = TYPE_MACRO,
+			.arg.ptr = w->macros[rnd(w, NMACROS)]};
+	if (r < 87)
+		return (struct chord_entry) {.type = TYPE_RECORD};
+	if (r < 95)
+		return (struct chord_entry) {.type = TYPE_UNDO};
+	return (struct chord_entry) {.type = TYPE_NONE};
+}
+
+/*
+ * Builds a random keymap for a seed.  Odd seeds spread their chords over a
+ * wide code space to exercise the sparse keymap.
+ */
+static int build_keymap(struct worker *w, unsigned long seed)
+{
+	unsigned int bits = seed & 1 ? 12 : 4;
+	int i, j;
+
+	for (i = 0; i < NMACROS; i++) {
+		int len = 1 + rnd(w, MACRO_LEN);
+		for (j = 0; j < len; j++)
+			w->macros[i][j] = macro_entry(w);
+		w->macros[i][len] = (struct chord_entry) {.type = TYPE_NONE};
+	}
+
+	// Every map gets a chord back to the first; the rest are random, with
+	// codes kept distinct within each map
+	for (i = 0; i < NBINDINGS; i++) {
+		struct chord_binding *b = &w->bindings[i];
+		b->map = i % NMAPS;
+		do {
+			b->code = 1 + rnd(w, (1UL << bits) - 1);
+			for (j = 0; j < i; j++)
+				if (w->bindings[j].map == b->map &&
+						w->bindings[j].code == b->code)
+					break;
+		} while (j < i);
+		if (i < NMAPS)
+			b->entry = (struct chord_entry) {.type = TYPE_MAP,
+				.arg.map = 0};
+		else
+			b->entry = random_entry(w);
+		b->long_entry = rnd(w, 4) ? (struct chord_entry)
+			{.type = TYPE_NONE} : random_entry(w);
+	}
+
+	if (chorder_init_sparse(&w->kbd, w->bindings, NBINDINGS, NMAPS, bits,
+				shadow_press, w))
+		return 1;
+	if (chorder_init_macros(&w->kbd, ARENA_SIZE) ||
+			chorder_init_counts(&w->kbd)) {
+		chorder_destroy(&w->kbd);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Runs one seed, returning nonzero if it failed
+ */
+static int run_seed(struct worker *w, unsigned long seed)
+{
+	w->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+	memset(w->down, 0, sizeof(w->down));
+	w->ndown = 0;
+	w->seed = seed;
+	if (build_keymap(w, seed)) {
+		snprintf(w->error, sizeof(w->error), "out of memory");
+		return 1;
+	}
+
+	unsigned long i;
+	for (i = 0; i < npresses && !w->error[0]; i++) {
+		w->step = i;
+		const struct chord_binding *b = &w->bindings[rnd(w,
+				NBINDINGS)];
+		int rv = rnd(w, 5) ? chorder_press(&w->kbd, b->code) :
+			chorder_press_long(&w->kbd, b->code);
+		if (rv) {
+			snprintf(w->error, sizeof(w->error),
+					"chorder_press failed");
+			break;
+		}
+
+		// Everything down must still be held or locked by the chorder
+		unsigned int held = check_stack(w, w->kbd.mods, NULL) +
+			check_stack(w, w->kbd.lockmods, w->kbd.mods);
+		if (!w->error[0] && held != w->ndown)
+			snprintf(w->error, sizeof(w->error),
+					"%u keys down but %u held", w->ndown,
+					held);
+	}
+	w->presses += i;
+
+	w->step = i;
+	chorder_destroy(&w->kbd);
+	if (!w->error[0] && w->ndown)
+		snprintf(w->error, sizeof(w->error),
+				"%u keys left down after destroy", w->ndown);
+	return w->error[0] != 0;
+}
+
+/*
+ * Thread body which runs its share of the seeds until one fails
+ */
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long seed;
+	for (seed = w->first; seed < w->end; seed += w->stride) {
+		if (__atomic_load_n(&failed, __ATOMIC_RELAXED))
+			break;
+		if (run_seed(w, seed)) {
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long first = 1, nseeds = 0;
+	int verbose = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:n:s:S:v")) != -1) {
+		switch (opt) {
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'n':
+				npresses = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				nseeds = strtoul(optarg, NULL, 0);
+				break;
+			case 'S':
+				first = strtoul(optarg, NULL, 0);
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-v] [-j threads] "
+						"[-n presses] [-s seeds] "
+						"[-S first-seed]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	if (!nseeds)
+		nseeds = 4 * nthreads;
+
+	// The chorder complains about every unmapped chord and failed undo,
+	// which would swamp the output and slow everything down
+	if (!verbose && !freopen("/dev/null", "w", stderr))
+		return 1;
+
+	struct worker *workers = calloc(nthreads, sizeof(workers[0]));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	int i, started;
+	for (started = 0; started < nthreads; started++) {
+		struct worker *w = &workers[started];
+		w->first = first + started;
+		w->stride = nthreads;
+		w->end = first + nseeds;
+		if (pthread_create(&w->tid, NULL, run_worker, w)) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	unsigned long total = 0;
+	int ret = started < nthreads;
+	for (i = 0; i < started; i++) {
+		struct worker *w = &workers[i];
+		pthread_join(w->tid, NULL);
+		total += w->presses;
+		if (w->error[0]) {
+			printf("seed %lu, press %lu: %s\n", w->seed, w->step,
+					w->error);
+			ret = 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%lu presses over %lu seeds in %.2f s (%.1f M/s)\n", total,
+			nseeds, secs, secs > 0 ? total / secs / 1e6 : 0.0);
+	free(workers);
+	return ret;
+}
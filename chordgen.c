@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/Xlib.h>
+
+#include "chorder.h"
+#include "english_optimized.h"
+
+/*
+ * Writes out a chorder specialized for the compiled-in keymap.  The result
+ * includes chorder.c for everything but chorder_press, which has each
+ * chord's action spelled out: keys and mods from constant tables, a case of
+ * its own for each map switch, and macros unrolled into the key events they
+ * send.  Every action first checks that the live entry is still the one it
+ * was generated from, and anything it can't handle goes to the interpreter,
+ * so the behaviour is the same as chorder.c's.
+ */
+
+// Most entries in a macro we will unroll, and mods it may leave held
+#define MAX_MACRO 64
+#define MAX_MODS 16
+
+/*
+ * Key event sent by a macro, and the mods it leaves held and locked
+ */
+struct unrolled {
+	unsigned long syms[4 * MAX_MACRO];
+	int presses[4 * MAX_MACRO];
+	int nevents;
+	unsigned long mods[MAX_MODS], locks[MAX_MODS];
+	int nmods, nlocks;
+	unsigned int chars;
+	int irreversible;
+};
+
+/*
+ * Removes a mod from a list, returning 1 if it was there
+ */
+static int take(unsigned long *list, int *n, unsigned long code)
+{
+	int i;
+	for (i = 0; i < *n; i++) {
+		if (list[i] == code) {
+			for (; i < *n - 1; i++)
+				list[i] = list[i + 1];
+			(*n)--;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Returns 1 if every mod in a list is Shift
+ */
+static int only_shift(const unsigned long *list, int n)
+{
+	while (n--)
+		if (list[n] != XK_Shift_L && list[n] != XK_Shift_R)
+			return 0;
+	return 1;
+}
+
+/*
+ * Adds a key event to an unrolled macro
+ */
+static void send(struct unrolled *u, unsigned long sym, int press)
+{
+	u->syms[u->nevents] = sym;
+	u->presses[u->nevents++] = press;
+}
+
+/*
+ * Works out what a macro does when no mods are held outside it, following
+ * handle_entry.  Mod lists are kept top of stack first.  Returns 1 if the
+ * macro has entries that aren't worth unrolling.
+ */
+static int unroll(const struct chord_entry *macro, struct unrolled *u)
+{
+	unsigned long mods[MAX_MODS], locks[MAX_MODS];
+	int nmods = 0, nlocks = 0, i, n;
+
+	u->nevents = 0;
+	u->chars = 0;
+	u->irreversible = 0;
+	for (n = 0; macro[n].type != TYPE_NONE; n++) {
+		unsigned long code = macro[n].arg.code;
+		if (n >= MAX_MACRO)
+			return 1;
+		switch (macro[n].type) {
+			case TYPE_KEY:
+				if (chorder_is_text(code) && only_shift(mods, nmods) &&
+						only_shift(locks, nlocks))
+					u->chars++;
+				else
+					u->irreversible = 1;
+				send(u, code, 1);
+				send(u, code, 0);
+				for (i = 0; i < nmods; i++)
+					send(u, mods[i], 0);
+				nmods = 0;
+				break;
+			case TYPE_MOD:
+				if (take(locks, &nlocks, code)) {
+					send(u, code, 0);
+				} else if (take(mods, &nmods, code)) {
+					if (nlocks >= MAX_MODS)
+						return 1;
+					for (i = nlocks++; i > 0; i--)
+						locks[i] = locks[i - 1];
+					locks[0] = code;
+				} else {
+					if (nmods >= MAX_MODS)
+						return 1;
+					for (i = nmods++; i > 0; i--)
+						mods[i] = mods[i - 1];
+					mods[0] = code;
+					send(u, code, 1);
+				}
+				break;
+			case TYPE_MODLOCK:
+				if (take(locks, &nlocks, code)) {
+					send(u, code, 0);
+					break;
+				}
+				if (nlocks >= MAX_MODS)
+					return 1;
+				for (i = nlocks++; i > 0; i--)
+					locks[i] = locks[i - 1];
+				locks[0] = code;
+				if (!take(mods, &nmods, code))
+					send(u, code, 1);
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	// The mods are pushed onto the outside stacks top first, as
+	// handle_entry pops them
+	for (i = 0; i < nmods; i++)
+		u->mods[i] = mods[i];
+	for (i = 0; i < nlocks; i++)
+		u->locks[i] = locks[i];
+	u->nmods = nmods;
+	u->nlocks = nlocks;
+	return 0;
+}
+
+/*
+ * Prints a keysym as a constant with its name alongside
+ */
+static void print_sym(unsigned long sym)
+{
+	const char *name = XKeysymToString(sym);
+	printf("%#lx /* %s */", sym, name ? name : "?");
+}
+
+/*
+ * Prints a list of keysyms as a static array
+ */
+static void print_syms(const char *name, const unsigned long *syms, int n)
+{
+	int i;
+	printf("static const unsigned long %s[] = {", name);
+	for (i = 0; i < n; i++) {
+		printf("\n\t");
+		print_sym(syms[i]);
+		printf(",");
+	}
+	printf("\n\t0,\n};\n");
+}
+
+/*
+ * Prints the constant data for a macro entry, returning 1 if it can't be
+ * unrolled
+ */
+static int print_macro(unsigned long m, unsigned long c,
+		const struct chord_entry *macro)
+{
+	struct unrolled u;
+	if (unroll(macro, &u))
+		return 1;
+
+	int i;
+	printf("\n// Macro on chord %#lx of map %lu\n", c, m);
+	printf("static const struct chord_entry macro_%lu_%lu[] = {\n", m, c);
+	for (i = 0; macro[i].type != TYPE_NONE; i++) {
+		printf("\t{.type = %d, .arg.code = ", macro[i].type);
+		print_sym(macro[i].arg.code);
+		printf("},\n");
+	}
+	printf("\t{.type = TYPE_NONE},\n};\n");
+
+	printf("static const struct compiled_event events_%lu_%lu[] = {\n",
+			m, c);
+	for (i = 0; i < u.nevents; i++) {
+		printf("\t{");
+		print_sym(u.syms[i]);
+		printf(", %d},\n", u.presses[i]);
+	}
+	printf("};\n");
+
+	char name[64];
+	snprintf(name, sizeof(name), "mods_%lu_%lu", m, c);
+	print_syms(name, u.mods, u.nmods);
+	snprintf(name, sizeof(name), "locks_%lu_%lu", m, c);
+	print_syms(name, u.locks, u.nlocks);
+	printf("static const struct compiled_macro unrolled_%lu_%lu = {\n"
+			"\tevents_%lu_%lu, %d, mods_%lu_%lu, locks_%lu_%lu, "
+			"%u, %d,\n};\n", m, c, m, c, u.nevents, m, c, m, c,
+			u.chars, u.irreversible);
+	return 0;
+}
+
+/*
+ * Prints the case for a chord of a map which switches maps or runs a macro
+ */
+static void print_case(unsigned long m, unsigned long c,
+		unsigned long per_map, const struct chord_entry *e,
+		const unsigned char *unrollable)
+{
+	unsigned long idx = m * per_map + c;
+
+	switch (e->type) {
+		case TYPE_MAP:
+		case TYPE_MAPLOCK:
+			printf("\n\t\t// Chord %#lx of map %lu\n", c, m);
+			printf("\t\tcase %lu:\n", idx);
+			printf("\t\t\tif (e->type != %s || "
+					"e->arg.map != %u)\n",
+					e->type == TYPE_MAP ? "TYPE_MAP" :
+					"TYPE_MAPLOCK", e->arg.map);
+			printf("\t\t\t\tbreak;\n");
+			printf("\t\t\tcompiled_begin(kbd, e, %lu);\n", idx);
+			if (e->type == TYPE_MAPLOCK) {
+				printf("\t\t\tkbd->current_map = %u;\n",
+						e->arg.map);
+				printf("\t\t\tkbd->maplock = 1;\n");
+			} else if (e->arg.map == m) {
+				// Selecting the map we're on locks or unlocks it
+				printf("\t\t\tif (kbd->maplock)\n");
+				printf("\t\t\t\tkbd->current_map = 0;\n");
+				printf("\t\t\tkbd->maplock = !kbd->maplock;\n");
+			} else {
+				printf("\t\t\tkbd->current_map = %u;\n",
+						e->arg.map);
+				printf("\t\t\tkbd->maplock = 0;\n");
+			}
+			printf("\t\t\treturn 0;");
+			break;
+		case TYPE_MACRO:
+			if (!unrollable[idx])
+				break;
+			printf("\n\t\t// Chord %#lx of map %lu\n", c, m);
+			printf("\t\tcase %lu:\n", idx);
+			printf("\t\t\tif (e->type != TYPE_MACRO || kbd->mods || "
+					"kbd->lockmods ||\n"
+					"\t\t\t\t\t!same_macro(e->arg.ptr, "
+					"macro_%lu_%lu))\n", m, c);
+			printf("\t\t\t\tbreak;\n");
+			printf("\t\t\treturn compiled_macro(kbd, e, %lu, "
+					"&unrolled_%lu_%lu);", idx, m, c);
+			break;
+		default:
+			// Keys and mods go by the tables, and the rest is
+			// rarely used, so left to the interpreter
+			break;
+	}
+}
+
+int main(void)
+{
+	unsigned long maps = sizeof(map) / sizeof(map[0]);
+	unsigned long per_map = sizeof(map[0]) / sizeof(map[0][0]);
+	unsigned char *unrollable = calloc(maps * per_map, 1);
+	unsigned long m, c;
+	if (!unrollable) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("/*\n"
+		" * Generated by chordgen from english_optimized.h; do not edit.\n"
+		" * The interpreter in chorder.c provides everything but\n"
+		" * chorder_press, which is specialized for this keymap, and\n"
+		" * chorder_press_long, which falls back to it.\n"
+		" */\n\n"
+		"#define chorder_press chorder_interp_press\n"
+		"#define chorder_press_long chorder_interp_press_long\n"
+		"#include \"chorder.c\"\n"
+		"#undef chorder_press\n"
+		"#undef chorder_press_long\n\n"
+		"// The renaming above also renamed the prototypes chorder.h\n"
+		"// gave these, so they are declared again under their own names\n"
+		"int chorder_press(struct chorder *kbd, unsigned long entry);\n"
+		"int chorder_press_long(struct chorder *kbd, unsigned long entry);\n\n"
+		"#define COMPILED_MAPS %lu\n"
+		"#define COMPILED_PER_MAP %lu\n\n", maps, per_map);
+
+	printf("%s",
+		"// Key event sent by an unrolled macro\n"
+		"struct compiled_event {\n"
+		"\tunsigned long sym;\n"
+		"\tint press;\n"
+		"};\n\n"
+		"// What a macro does when no mods are held outside it\n"
+		"struct compiled_macro {\n"
+		"\tconst struct compiled_event *events;\n"
+		"\tint nevents;\n"
+		"\t// Mods left held and locked, top first, ending in 0\n"
+		"\tconst unsigned long *mods, *locks;\n"
+		"\tunsigned int chars;\n"
+		"\tint irreversible;\n"
+		"};\n\n"
+		"/*\n"
+		" * Counts and journals a chord, and records it if need be\n"
+		" */\n"
+		"static void compiled_begin(struct chorder *kbd, "
+			"struct chord_entry *e,\n"
+		"\t\tunsigned long idx)\n"
+		"{\n"
+		"\tif (kbd->counts)\n"
+		"\t\tkbd->counts[idx]++;\n"
+		"\tjournal_begin(kbd);\n"
+		"\tif (kbd->recording)\n"
+		"\t\trecord_entry(kbd, e);\n"
+		"}\n\n"
+		"/*\n"
+		" * Types a key, then lets go of any mods held for it\n"
+		" */\n"
+		"static int compiled_key(struct chorder *kbd, "
+			"struct chord_entry *e,\n"
+		"\t\tunsigned long idx, unsigned long sym)\n"
+		"{\n"
+		"\tunsigned long code;\n"
+		"\tcompiled_begin(kbd, e, idx);\n"
+		"\tjournal_key(kbd, sym);\n"
+		"\tkbd->press(kbd->arg, sym, 1);\n"
+		"\tkbd->press(kbd->arg, sym, 0);\n"
+		"\twhile ((code = popmod(&kbd->mods)))\n"
+		"\t\tkbd->press(kbd->arg, code, 0);\n"
+		"\tif (!kbd->maplock)\n"
+		"\t\tkbd->current_map = 0;\n"
+		"\treturn 0;\n"
+		"}\n\n"
+		"/*\n"
+		" * Presses, locks or lets go of a mod\n"
+		" */\n"
+		"static int compiled_mod(struct chorder *kbd, "
+			"struct chord_entry *e,\n"
+		"\t\tunsigned long idx, unsigned long code, int lock)\n"
+		"{\n"
+		"\tcompiled_begin(kbd, e, idx);\n"
+		"\tif (removemod(&kbd->lockmods, code)) {\n"
+		"\t\tkbd->press(kbd->arg, code, 0);\n"
+		"\t} else if (removemod(&kbd->mods, code)) {\n"
+		"\t\tif (pushmod(&kbd->lockmods, code))\n"
+		"\t\t\treturn 1;\n"
+		"\t} else {\n"
+		"\t\tif (pushmod(lock ? &kbd->lockmods : &kbd->mods, code))\n"
+		"\t\t\treturn 1;\n"
+		"\t\tkbd->press(kbd->arg, code, 1);\n"
+		"\t}\n"
+		"\tif (!kbd->maplock)\n"
+		"\t\tkbd->current_map = 0;\n"
+		"\treturn 0;\n"
+		"}\n");
+
+	// Macros need helpers of their own, so only bring those in if
+	// there are any to unroll
+	struct unrolled u;
+	int nunrolled = 0;
+	for (m = 0; m < maps; m++) {
+		for (c = 0; c < per_map; c++) {
+			if (map[m][c].type != TYPE_MACRO ||
+					unroll(map[m][c].arg.ptr, &u))
+				continue;
+			unrollable[m * per_map + c] = 1;
+			nunrolled++;
+		}
+	}
+	if (nunrolled)
+		printf("%s",
+		"\n"
+		"/*\n"
+		" * Sends the key events of a macro worked out in advance\n"
+		" */\n"
+		"static int compiled_macro(struct chorder *kbd, "
+			"struct chord_entry *e,\n"
+		"\t\tunsigned long idx, const struct compiled_macro *cm)\n"
+		"{\n"
+		"\tconst unsigned long *code;\n"
+		"\tint i;\n"
+		"\tcompiled_begin(kbd, e, idx);\n"
+		"\tfor (i = 0; i < cm->nevents; i++)\n"
+		"\t\tkbd->press(kbd->arg, cm->events[i].sym, "
+			"cm->events[i].press);\n"
+		"\n"
+		"\tstruct chord_record *r = &kbd->journal[(kbd->journal_head +\n"
+		"\t\t\tkbd->journal_len - 1) % CHORDER_JOURNAL_LEN];\n"
+		"\tr->chars += cm->chars;\n"
+		"\tif (cm->irreversible)\n"
+		"\t\tr->irreversible = 1;\n"
+		"\n"
+		"\tfor (code = cm->mods; *code; code++)\n"
+		"\t\tif (pushmod(&kbd->mods, *code))\n"
+		"\t\t\treturn 1;\n"
+		"\tfor (code = cm->locks; *code; code++)\n"
+		"\t\tif (pushmod(&kbd->lockmods, *code))\n"
+		"\t\t\treturn 1;\n"
+		"\tif (!kbd->maplock)\n"
+		"\t\tkbd->current_map = 0;\n"
+		"\treturn 0;\n"
+		"}\n\n"
+		"/*\n"
+		" * Returns 1 if a macro still holds what it was generated from\n"
+		" */\n"
+		"static int same_macro(const struct chord_entry *a,\n"
+		"\t\tconst struct chord_entry *b)\n"
+		"{\n"
+		"\tfor (; a->type == b->type; a++, b++)\n"
+		"\t\tif (a->type == TYPE_NONE)\n"
+		"\t\t\treturn 1;\n"
+		"\t\telse if (a->arg.code != b->arg.code)\n"
+		"\t\t\treturn 0;\n"
+		"\treturn 0;\n"
+		"}\n");
+
+	for (m = 0; m < maps; m++)
+		for (c = 0; c < per_map; c++)
+			if (unrollable[m * per_map + c])
+				print_macro(m, c, map[m][c].arg.ptr);
+
+	// Keys and mods are looked up by their place in the keymap, as a
+	// jump per chord would mostly be mispredicted
+	printf("\n// Type of each chord, and the keysym typed or held for it\n");
+	printf("static const unsigned char types[] = {");
+	for (m = 0; m < maps; m++) {
+		for (c = 0; c < per_map; c++) {
+			enum chord_type t = map[m][c].type;
+			if (t != TYPE_KEY && t != TYPE_MOD && t != TYPE_MODLOCK)
+				t = TYPE_NONE;
+			printf("%s%d,", c % 16 ? " " : "\n\t", t);
+		}
+	}
+	printf("\n};\n");
+	printf("static const unsigned long syms[] = {");
+	for (m = 0; m < maps; m++) {
+		for (c = 0; c < per_map; c++) {
+			enum chord_type t = map[m][c].type;
+			printf("\n\t");
+			if (t == TYPE_KEY || t == TYPE_MOD || t == TYPE_MODLOCK)
+				print_sym(map[m][c].arg.code);
+			else
+				printf("0");
+			printf(",");
+		}
+	}
+	printf("\n};\n");
+
+	printf("\n"
+		"/*\n"
+		" * Handles a chord, going straight to its action if it is in the\n"
+		" * keymap as generated\n"
+		" */\n"
+		"int chorder_press(struct chorder *kbd, unsigned long entry)\n"
+		"{\n"
+		"\tif (kbd->binding || kbd->codes || kbd->maps != COMPILED_MAPS ||\n"
+		"\t\t\tkbd->entries_per_map != COMPILED_PER_MAP ||\n"
+		"\t\t\tkbd->current_map >= COMPILED_MAPS ||\n"
+		"\t\t\tentry >= COMPILED_PER_MAP)\n"
+		"\t\treturn chorder_interp_press(kbd, entry);\n"
+		"\n"
+		"\tunsigned long idx = kbd->current_map * COMPILED_PER_MAP + entry;\n"
+		"\tstruct chord_entry *e = kbd->entries + idx;\n"
+		"\tswitch (types[idx]) {\n"
+		"\t\tcase TYPE_KEY:\n"
+		"\t\t\tif (e->type != TYPE_KEY || e->arg.code != syms[idx])\n"
+		"\t\t\t\tbreak;\n"
+		"\t\t\treturn compiled_key(kbd, e, idx, syms[idx]);\n"
+		"\t\tcase TYPE_MOD:\n"
+		"\t\tcase TYPE_MODLOCK:\n"
+		"\t\t\tif (e->type != types[idx] || e->arg.code != syms[idx])\n"
+		"\t\t\t\tbreak;\n"
+		"\t\t\treturn compiled_mod(kbd, e, idx, syms[idx],\n"
+		"\t\t\t\t\ttypes[idx] == TYPE_MODLOCK);\n"
+		"\t}\n"
+		"\n"
+		"\tswitch (idx) {");
+	for (m = 0; m < maps; m++)
+		for (c = 0; c < per_map; c++)
+			print_case(m, c, per_map, &map[m][c], unrollable);
+	printf("\n\t}\n"
+		"\treturn chorder_interp_press(kbd, entry);\n"
+		"}\n");
+
+	// The interpreter's chorder_press_long would fall back to the
+	// interpreter's chorder_press
+	printf("\n"
+		"/*\n"
+		" * Handles a held chord, falling back to the specialized\n"
+		" * chorder_press if it has no long-press variant\n"
+		" */\n"
+		"int chorder_press_long(struct chorder *kbd, unsigned long entry)\n"
+		"{\n"
+		"\tif (!chorder_get_long(kbd, kbd->current_map, entry))\n"
+		"\t\treturn chorder_press(kbd, entry);\n"
+		"\treturn chorder_interp_press_long(kbd, entry);\n"
+		"}\n");
+
+	free(unrollable);
+	return 0;
+}
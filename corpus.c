@@ -0,0 +1,158 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+
+/*
+ * Decodes the UTF-8 character at *p and advances past it.  Returns the code
+ * point, CORPUS_INVALID for a malformed sequence (skipping its bytes), or
+ * CORPUS_PARTIAL if the sequence runs past the end and more text follows
+ * (leaving *p unchanged).
+ */
+unsigned long corpus_decode(const unsigned char **p, const unsigned char *end,
+		int last)
+{
+	const unsigned char *s = *p;
+	unsigned char b = *s;
+	if (b < 0x80) {
+		*p = s + 1;
+		return b;
+	}
+
+	int n = b >= 0xf8 ? -1 : b >= 0xf0 ? 3 : b >= 0xe0 ? 2 :
+		b >= 0xc0 ? 1 : -1;
+	if (n < 0) {
+		*p = s + 1;
+		return CORPUS_INVALID;
+	}
+	if (!last && end - s <= n)
+		return CORPUS_PARTIAL;
+
+	unsigned long cp = b & (0x3f >> n);
+	int k;
+	for (k = 1; k <= n; k++) {
+		if (s + k >= end || (s[k] & 0xc0) != 0x80) {
+			*p = s + k;
+			return CORPUS_INVALID;
+		}
+		cp = (cp << 6) | (s[k] & 0x3f);
+	}
+	*p = s + n + 1;
+	return cp;
+}
+
+/*
+ * One piece of a mapped file handed to a thread
+ */
+struct chunk {
+	corpus_fn fn;
+	void *arg;
+	const unsigned char *buf;
+	size_t len;
+};
+
+/*
+ * Thread body running the function on its piece
+ */
+static void *run_chunk(void *arg)
+{
+	struct chunk *c = arg;
+	c->fn(c->arg, c->buf, c->len, 1);
+	return NULL;
+}
+
+/*
+ * Maps a file and splits it among threads at character boundaries, running
+ * the function on each piece with the corresponding argument
+ */
+int corpus_map_file(const char *path, corpus_fn fn, void **args, int nthreads)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror(path);
+		close(fd);
+		return 1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	const unsigned char *buf = mmap(NULL, st.st_size, PROT_READ,
+			MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		perror(path);
+		return 1;
+	}
+	madvise((void *) buf, st.st_size, MADV_SEQUENTIAL);
+
+	pthread_t tids[nthreads];
+	struct chunk chunks[nthreads];
+	size_t len = st.st_size, start = 0;
+	int i, started;
+	for (i = 0; i < nthreads; i++) {
+		size_t end = (i == nthreads - 1) ? len : len / nthreads * (i + 1);
+		while (end < len && (buf[end] & 0xc0) == 0x80)
+			end++;
+		if (end < start)
+			end = start;
+		chunks[i] = (struct chunk) {fn, args[i], buf + start, end - start};
+		start = end;
+	}
+
+	// Fall back to running pieces here if a thread can't be started
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, run_chunk,
+					&chunks[started]))
+			break;
+	for (i = started; i < nthreads; i++)
+		run_chunk(&chunks[i]);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	munmap((void *) buf, st.st_size);
+	return 0;
+}
+
+/*
+ * Runs the function over a stream which cannot be mapped, in blocks
+ */
+int corpus_stream(int fd, corpus_stream_fn fn, void *arg)
+{
+	unsigned char *buf = malloc(CORPUS_BLOCK_SIZE);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+
+	size_t have = 0;
+	ssize_t got;
+	while ((got = read(fd, buf + have, CORPUS_BLOCK_SIZE - have)) > 0) {
+		have += got;
+		size_t used = fn(arg, buf, have, 0);
+		memmove(buf, buf + used, have - used);
+		have -= used;
+	}
+	fn(arg, buf, have, 1);
+	free(buf);
+	if (got < 0) {
+		perror("read");
+		return 1;
+	}
+	return 0;
+}
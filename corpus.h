@@ -0,0 +1,33 @@
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+#include <stddef.h>
+
+// Returned by corpus_decode for malformed input and cut-off sequences
+#define CORPUS_INVALID (~0UL)
+#define CORPUS_PARTIAL (~0UL - 1)
+
+// Size of blocks read from a stream
+#define CORPUS_BLOCK_SIZE (1 << 20)
+
+/*
+ * Function run on one piece of a corpus.  The last flag is set when no more
+ * text follows the buffer.
+ */
+typedef void (*corpus_fn)(void *arg, const unsigned char *buf, size_t len,
+		int last);
+
+/*
+ * Like corpus_fn, but returns how much of the buffer was used so that a
+ * sequence cut off at the end can be passed again with the next block
+ */
+typedef size_t (*corpus_stream_fn)(void *arg, const unsigned char *buf,
+		size_t len, int last);
+
+unsigned long corpus_decode(const unsigned char **p, const unsigned char *end,
+		int last);
+
+int corpus_map_file(const char *path, corpus_fn fn, void **args, int nthreads);
+int corpus_stream(int fd, corpus_stream_fn fn, void *arg);
+
+#endif
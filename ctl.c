@@ -0,0 +1,285 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+
+/*
+ * Starts listening on a Unix-domain socket at the given path, replacing any
+ * stale socket left there.  Anything else at the path is left alone, and the
+ * bind fails.
+ */
+int ctl_open(struct ctl *ctl, const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int i;
+
+	for (i = 0; i < CTL_MAX_CLIENTS; i++)
+		ctl->clients[i].fd = -1;
+	ctl->path = path;
+	ctl->fd = -1;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Control socket path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+
+	ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ctl->fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	struct stat st;
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if (bind(ctl->fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+			listen(ctl->fd, CTL_MAX_CLIENTS)) {
+		perror(path);
+		close(ctl->fd);
+		ctl->fd = -1;
+		return 1;
+	}
+	fcntl(ctl->fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+/*
+ * Disconnects a client
+ */
+static void drop_client(struct ctl_client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+}
+
+/*
+ * Disconnects every client and removes the socket
+ */
+void ctl_close(struct ctl *ctl)
+{
+	int i;
+
+	if (ctl->fd < 0)
+		return;
+	for (i = 0; i < CTL_MAX_CLIENTS; i++)
+		if (ctl->clients[i].fd >= 0)
+			drop_client(&ctl->clients[i]);
+	close(ctl->fd);
+	unlink(ctl->path);
+	ctl->fd = -1;
+}
+
+/*
+ * Fills in the descriptors to poll, returning how many there are.  Commands
+ * only run while there is room to queue their replies, so a client which
+ * doesn't read its replies stalls once its input buffer fills, rather than
+ * making us buffer without bound.
+ */
+int ctl_pollfds(const struct ctl *ctl, struct pollfd *fds)
+{
+	int i, n = 0;
+
+	if (ctl->fd < 0)
+		return 0;
+
+	fds[n++] = (struct pollfd) {.fd = ctl->fd, .events = POLLIN};
+	for (i = 0; i < CTL_MAX_CLIENTS; i++) {
+		const struct ctl_client *c = &ctl->clients[i];
+		if (c->fd < 0)
+			continue;
+		short events = 0;
+		if (c->inlen < sizeof(c->in))
+			events |= POLLIN;
+		if (c->outlen > c->outoff)
+			events |= POLLOUT;
+		fds[n++] = (struct pollfd) {.fd = c->fd, .events = events};
+	}
+	return n;
+}
+
+/*
+ * Copies up to CTL_MAX_MODS codes from a mod stack
+ */
+static uint32_t copy_mods(const struct mod_stack *mods, uint32_t *codes)
+{
+	uint32_t n;
+	for (n = 0; mods && n < CTL_MAX_MODS; mods = mods->next)
+		codes[n++] = mods->code;
+	return n;
+}
+
+/*
+ * Carries out one command
+ */
+static void run_cmd(struct chorder *kbd, const struct ctl_cmd *cmd,
+		struct ctl_reply *reply)
+{
+	struct chord_entry e;
+
+	memset(reply, 0, sizeof(*reply));
+	switch (cmd->op) {
+		case CTL_QUERY:
+			break;
+		case CTL_CHORD:
+			reply->status = chorder_press(kbd, cmd->arg);
+			break;
+		case CTL_MAP:
+		case CTL_MAPLOCK:
+			if (cmd->arg >= kbd->maps) {
+				reply->status = -1;
+				break;
+			}
+			e.type = cmd->op == CTL_MAP ? TYPE_MAP : TYPE_MAPLOCK;
+			e.arg.map = cmd->arg;
+			reply->status = chorder_press_entry(kbd, &e);
+			break;
+		default:
+			reply->status = -1;
+			break;
+	}
+
+	reply->current_map = kbd->current_map;
+	reply->maplock = kbd->maplock;
+	reply->nmods = copy_mods(kbd->mods, reply->mods);
+	reply->nlocks = copy_mods(kbd->lockmods, reply->locks);
+}
+
+/*
+ * Reads whatever a client has sent, returning 1 if the client has gone away
+ */
+static int read_client(struct ctl_client *c)
+{
+	ssize_t n = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen,
+			MSG_DONTWAIT);
+	if (n == 0)
+		return 1;
+	if (n < 0)
+		return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+	c->inlen += n;
+	return 0;
+}
+
+/*
+ * Runs every complete command from a client which there is room to reply
+ * to, returning the number run
+ */
+static int run_client(struct ctl_client *c, struct chorder *kbd)
+{
+	// Make room for replies at the front of the queue
+	if (c->outoff) {
+		memmove(c->out, c->out + c->outoff, c->outlen - c->outoff);
+		c->outlen -= c->outoff;
+		c->outoff = 0;
+	}
+
+	size_t off = 0;
+	int ran = 0;
+	while (c->inlen - off >= sizeof(struct ctl_cmd) &&
+			sizeof(c->out) - c->outlen >=
+			sizeof(struct ctl_reply)) {
+		struct ctl_cmd cmd;
+		struct ctl_reply reply;
+		memcpy(&cmd, c->in + off, sizeof(cmd));
+		run_cmd(kbd, &cmd, &reply);
+		memcpy(c->out + c->outlen, &reply, sizeof(reply));
+		c->outlen += sizeof(reply);
+		off += sizeof(cmd);
+		ran++;
+	}
+	memmove(c->in, c->in + off, c->inlen - off);
+	c->inlen -= off;
+	return ran;
+}
+
+/*
+ * Sends as many queued replies as the client will take without blocking,
+ * returning 1 if the client has gone away
+ */
+static int flush_client(struct ctl_client *c)
+{
+	while (c->outoff < c->outlen) {
+		ssize_t n = send(c->fd, c->out + c->outoff,
+				c->outlen - c->outoff,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0)
+			return errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR;
+		c->outoff += n;
+	}
+	c->outoff = c->outlen = 0;
+	return 0;
+}
+
+/*
+ * Accepts a new client, if there is room for one
+ */
+static void accept_client(struct ctl *ctl)
+{
+	int fd = accept(ctl->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	int i;
+	for (i = 0; i < CTL_MAX_CLIENTS; i++) {
+		if (ctl->clients[i].fd < 0) {
+			ctl->clients[i].fd = fd;
+			ctl->clients[i].inlen = 0;
+			ctl->clients[i].outoff = ctl->clients[i].outlen = 0;
+			return;
+		}
+	}
+	fprintf(stderr, "Too many control clients\n");
+	close(fd);
+}
+
+/*
+ * Handles activity on the polled descriptors: accepts new clients, runs the
+ * commands which have arrived and sends back replies.  Returns the number of
+ * commands run, so the caller knows whether to flush the keys they sent.
+ */
+int ctl_handle(struct ctl *ctl, const struct pollfd *fds, int nfds,
+		struct chorder *kbd)
+{
+	int i, j, ran = 0;
+
+	for (i = 0; i < nfds; i++) {
+		if (!fds[i].revents)
+			continue;
+		if (fds[i].fd == ctl->fd) {
+			accept_client(ctl);
+			continue;
+		}
+
+		struct ctl_client *c = NULL;
+		for (j = 0; j < CTL_MAX_CLIENTS; j++)
+			if (ctl->clients[j].fd == fds[i].fd)
+				c = &ctl->clients[j];
+		if (!c)
+			continue;
+
+		if (!(fds[i].revents & (POLLIN | POLLOUT)) ||
+				((fds[i].revents & POLLIN) && read_client(c))) {
+			drop_client(c);
+			continue;
+		}
+
+		// Sending replies may make room to run commands still waiting
+		// in the input buffer
+		if (flush_client(c)) {
+			drop_client(c);
+			continue;
+		}
+		ran += run_client(c, kbd);
+		if (flush_client(c))
+			drop_client(c);
+	}
+	return ran;
+}
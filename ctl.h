@@ -0,0 +1,84 @@
+#ifndef CTL_H_
+#define CTL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+
+#include "chorder.h"
+
+// Most clients connected at once
+#define CTL_MAX_CLIENTS 4
+
+// Commands read, and replies queued, per client at a time
+#define CTL_BATCH 64
+
+// Most held or locked mods reported
+#define CTL_MAX_MODS 8
+
+// Most descriptors the control socket needs polled
+#define CTL_MAX_FDS (CTL_MAX_CLIENTS + 1)
+
+// Commands understood on the control socket
+enum ctl_op {
+	// Only report the chorder state
+	CTL_QUERY,
+	// Press the chord whose code is given
+	CTL_CHORD,
+	// Select the given map for the next chord
+	CTL_MAP,
+	// Select the given map until another is selected
+	CTL_MAPLOCK,
+};
+
+/*
+ * Command sent by a client, in host byte order.  Clients may send any number
+ * back to back; each is answered with exactly one reply, in order.  Chords
+ * sent this way go straight to the chorder, so they are not counted as typed.
+ */
+struct ctl_cmd {
+	uint32_t op;
+	uint32_t arg;
+};
+
+/*
+ * Reply to a command: whether it succeeded and the chorder state after it
+ */
+struct ctl_reply {
+	int32_t status;
+	uint32_t current_map;
+	uint32_t maplock;
+	uint32_t nmods;
+	uint32_t nlocks;
+	uint32_t mods[CTL_MAX_MODS];
+	uint32_t locks[CTL_MAX_MODS];
+};
+
+/*
+ * Connection to one client, with its partly read commands and unsent replies
+ */
+struct ctl_client {
+	int fd;
+	unsigned char in[CTL_BATCH * sizeof(struct ctl_cmd)];
+	size_t inlen;
+	unsigned char out[CTL_BATCH * sizeof(struct ctl_reply)];
+	size_t outoff, outlen;
+};
+
+/*
+ * Listening control socket and its clients
+ */
+struct ctl {
+	int fd;
+	const char *path;
+	struct ctl_client clients[CTL_MAX_CLIENTS];
+};
+
+int ctl_open(struct ctl *ctl, const char *path);
+void ctl_close(struct ctl *ctl);
+
+int ctl_pollfds(const struct ctl *ctl, struct pollfd *fds);
+int ctl_handle(struct ctl *ctl, const struct pollfd *fds, int nfds,
+		struct chorder *kbd);
+
+#endif
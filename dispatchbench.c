@@ -0,0 +1,91 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chorder.h"
+#include "english_optimized.h"
+
+/*
+ * Times chorder_press on the compiled-in keymap, with the key events going
+ * nowhere but into a hash.  Built twice, against the interpreter in chorder.c
+ * and against the generated chorder_gen.c, so the two can be compared; both
+ * must print the same hash for the same seed.
+ */
+
+#define DEF_PRESSES 50000000
+#define MAPS (sizeof(map) / sizeof(map[0]))
+#define PER_MAP (sizeof(map[0]) / sizeof(map[0][0]))
+
+/*
+ * FNV-1a hash of the key events sent
+ */
+static uint64_t hash = 0xcbf29ce484222325ULL;
+
+/*
+ * Keypress implementation to pass to the chorder
+ */
+static void hash_press(void *arg, unsigned long sym, int press)
+{
+	(void) arg;
+	hash = (hash ^ (sym << 1 | press)) * 0x100000001b3ULL;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long npresses = DEF_PRESSES;
+	uint64_t rng = 88172645463325252ULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:S:")) != -1) {
+		switch (opt) {
+			case 'n':
+				npresses = strtoul(optarg, NULL, 0);
+				break;
+			case 'S':
+				rng = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n presses] [-S seed]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (!rng)
+		rng = 1;
+
+	// Only press chords which are mapped, so the unmapped-chord warnings
+	// don't drown out the dispatch
+	static unsigned long codes[MAPS][PER_MAP];
+	unsigned long ncodes[MAPS] = {0};
+	unsigned long m, c;
+	for (m = 0; m < MAPS; m++)
+		for (c = 0; c < PER_MAP; c++)
+			if (map[m][c].type != TYPE_NONE)
+				codes[m][ncodes[m]++] = c;
+
+	struct chorder kbd;
+	if (chorder_init(&kbd, (const struct chord_entry *) map, MAPS, PER_MAP,
+				hash_press, NULL))
+		return 1;
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	unsigned long i;
+	for (i = 0; i < npresses; i++) {
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		m = kbd.current_map;
+		if (chorder_press(&kbd, codes[m][rng % ncodes[m]]))
+			break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	chorder_destroy(&kbd);
+
+	double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	printf("%lu presses, %.1f ns each, hash %016llx\n", i,
+			i ? ns / i : 0.0, (unsigned long long) hash);
+	return i < npresses;
+}
@@ -0,0 +1,135 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+/*
+ * Adds a record to the ring, overwriting the oldest once it is full
+ */
+void flight_log(struct flight *f, enum flight_event type, uint32_t a,
+		uint32_t b, uint32_t c)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	struct flight_record *r = &f->ring[f->next++ % FLIGHT_RECORDS];
+	r->time = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	r->type = type;
+	r->a = a;
+	r->b = b;
+	r->c = c;
+}
+
+/*
+ * Copies up to FLIGHT_MODS codes from a mod stack
+ */
+static unsigned int copy_mods(const struct mod_stack *mods,
+		unsigned long *codes)
+{
+	unsigned int n;
+	for (n = 0; mods && n < FLIGHT_MODS; mods = mods->next)
+		codes[n++] = mods->code;
+	return n;
+}
+
+/*
+ * Returns 1 if a code is in a list
+ */
+static int has_code(const unsigned long *codes, unsigned int n,
+		unsigned long code)
+{
+	while (n--)
+		if (codes[n] == code)
+			return 1;
+	return 0;
+}
+
+/*
+ * Logs the mods pushed onto and popped off one stack since it was last seen
+ */
+static void log_mods(struct flight *f, const unsigned long *old,
+		unsigned int nold, const unsigned long *cur, unsigned int ncur,
+		int locked)
+{
+	unsigned int i;
+	for (i = 0; i < nold; i++)
+		if (!has_code(cur, ncur, old[i]))
+			flight_log(f, FLIGHT_MOD_POP, old[i], locked, 0);
+	for (i = 0; i < ncur; i++)
+		if (!has_code(old, nold, cur[i]))
+			flight_log(f, FLIGHT_MOD_PUSH, cur[i], locked, 0);
+}
+
+/*
+ * Logs how the chorder's map and mods have changed since the last call.
+ * Called after each chord, so changes within a macro show up only as the
+ * keys it sent.
+ */
+void flight_chorder(struct flight *f, const struct chorder *kbd)
+{
+	unsigned long mods[FLIGHT_MODS], locks[FLIGHT_MODS];
+	unsigned int nmods = copy_mods(kbd->mods, mods);
+	unsigned int nlocks = copy_mods(kbd->lockmods, locks);
+
+	log_mods(f, f->mods, f->nmods, mods, nmods, 0);
+	log_mods(f, f->locks, f->nlocks, locks, nlocks, 1);
+	if (kbd->current_map != f->map || kbd->maplock != f->maplock)
+		flight_log(f, FLIGHT_MAP, kbd->current_map, kbd->maplock, 0);
+
+	memcpy(f->mods, mods, nmods * sizeof(mods[0]));
+	memcpy(f->locks, locks, nlocks * sizeof(locks[0]));
+	f->nmods = nmods;
+	f->nlocks = nlocks;
+	f->map = kbd->current_map;
+	f->maplock = kbd->maplock;
+}
+
+/*
+ * Writes the ring out to a file, oldest record first
+ */
+int flight_dump(const struct flight *f, const char *path)
+{
+	size_t len = strlen(path) + sizeof(".tmp");
+	char *tmp = malloc(len);
+	if (!tmp)
+		return 1;
+	snprintf(tmp, len, "%s.tmp", path);
+
+	// Every key typed is in here, so only the user may read it.  A
+	// leftover temporary file would keep its old mode, so start afresh.
+	unlink(tmp);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!fp) {
+		perror(tmp);
+		if (fd >= 0)
+			close(fd);
+		free(tmp);
+		return 1;
+	}
+
+	struct flight_header h = {
+		.magic = FLIGHT_MAGIC,
+		.version = FLIGHT_VERSION,
+		.count = f->next < FLIGHT_RECORDS ? f->next : FLIGHT_RECORDS,
+	};
+	uint32_t first = f->next - h.count, i;
+	int rv = fwrite(&h, sizeof(h), 1, fp) != 1;
+	for (i = 0; !rv && i < h.count; i++)
+		rv = fwrite(&f->ring[(first + i) % FLIGHT_RECORDS],
+				sizeof(f->ring[0]), 1, fp) != 1;
+
+	rv |= fclose(fp) != 0;
+	if (!rv && rename(tmp, path)) {
+		perror(path);
+		rv = 1;
+	}
+	free(tmp);
+	return rv;
+}
@@ -0,0 +1,82 @@
+#ifndef FLIGHT_H_
+#define FLIGHT_H_
+
+#include <inttypes.h>
+
+#include "chorder.h"
+
+// Records kept in the ring (a power of two)
+#define FLIGHT_RECORDS 4096
+
+// Identifies a dump file, and the version of its layout
+#define FLIGHT_MAGIC "GKOSFLT"
+#define FLIGHT_VERSION 1
+
+// Most mods of each kind compared between chords
+#define FLIGHT_MODS 8
+
+/*
+ * Kinds of record, with what their arguments hold
+ */
+enum flight_event {
+	// Touch id, x, y
+	FLIGHT_TOUCH_BEGIN,
+	// Touch id
+	FLIGHT_TOUCH_END,
+	// Touch id, button index (FLIGHT_MISS if none)
+	FLIGHT_HIT,
+	// Chord bits, whether held for the long variant
+	FLIGHT_CHORD,
+	// Keymap, whether locked
+	FLIGHT_MAP,
+	// Mod keysym, whether locked rather than held
+	FLIGHT_MOD_PUSH,
+	FLIGHT_MOD_POP,
+	// Keysym, whether pressed
+	FLIGHT_KEY,
+	// Chord bits whose press failed
+	FLIGHT_ERROR,
+};
+
+#define FLIGHT_MISS UINT32_MAX
+
+/*
+ * One event, stamped with the monotonic time in microseconds
+ */
+struct flight_record {
+	uint64_t time;
+	uint32_t type;
+	uint32_t a, b, c;
+};
+
+/*
+ * Start of a dump file, followed by count records, oldest first
+ */
+struct flight_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+};
+
+/*
+ * Ring of the most recent events, and the chorder state last logged so that
+ * only changes are recorded
+ */
+struct flight {
+	struct flight_record ring[FLIGHT_RECORDS];
+	// Number of records ever logged
+	uint32_t next;
+
+	unsigned long map;
+	unsigned long mods[FLIGHT_MODS];
+	unsigned long locks[FLIGHT_MODS];
+	unsigned int nmods, nlocks;
+	unsigned int maplock : 1;
+};
+
+void flight_log(struct flight *f, enum flight_event type, uint32_t a,
+		uint32_t b, uint32_t c);
+void flight_chorder(struct flight *f, const struct chorder *kbd);
+int flight_dump(const struct flight *f, const char *path);
+
+#endif
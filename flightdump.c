@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <X11/Xlib.h>
+
+#include "flight.h"
+
+/*
+ * Prints a flight recorder dump, one event per line.  Times are in
+ * milliseconds before the last event recorded.
+ */
+
+/*
+ * Returns the name of a keysym, or its number if it has none
+ */
+static const char *sym_name(uint32_t sym, char *buf, size_t len)
+{
+	const char *name = XKeysymToString(sym);
+	if (name)
+		return name;
+	snprintf(buf, len, "%#lx", (unsigned long) sym);
+	return buf;
+}
+
+/*
+ * Prints one record
+ */
+static void print_record(const struct flight_record *r, uint64_t end)
+{
+	char buf[16];
+
+	printf("%10.3f ", -(double) (end - r->time) / 1e3);
+	switch (r->type) {
+		case FLIGHT_TOUCH_BEGIN:
+			printf("touch %u begin at %d,%d\n", r->a,
+					(int32_t) r->b, (int32_t) r->c);
+			break;
+		case FLIGHT_TOUCH_END:
+			printf("touch %u end\n", r->a);
+			break;
+		case FLIGHT_HIT:
+			if (r->b == FLIGHT_MISS)
+				printf("touch %u missed\n", r->a);
+			else
+				printf("touch %u on button %u\n", r->a, r->b);
+			break;
+		case FLIGHT_CHORD:
+			printf("chord %#x%s\n", r->a, r->b ? " (long)" : "");
+			break;
+		case FLIGHT_MAP:
+			printf("map %u%s\n", r->a, r->b ? " (locked)" : "");
+			break;
+		case FLIGHT_MOD_PUSH:
+			printf("%s %s\n", r->b ? "lock" : "hold",
+					sym_name(r->a, buf, sizeof(buf)));
+			break;
+		case FLIGHT_MOD_POP:
+			printf("%s %s\n", r->b ? "unlock" : "let go",
+					sym_name(r->a, buf, sizeof(buf)));
+			break;
+		case FLIGHT_KEY:
+			printf("key %s %s\n", sym_name(r->a, buf, sizeof(buf)),
+					r->b ? "down" : "up");
+			break;
+		case FLIGHT_ERROR:
+			printf("chord %#x failed\n", r->a);
+			break;
+		default:
+			printf("unknown record %u\n", r->type);
+			break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s dump\n", argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[1], "r");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	struct flight_header h;
+	static struct flight_record recs[FLIGHT_RECORDS];
+	int ret = 1;
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+			memcmp(h.magic, FLIGHT_MAGIC, sizeof(FLIGHT_MAGIC))) {
+		fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+		goto out;
+	}
+	if (h.version != FLIGHT_VERSION || h.count > FLIGHT_RECORDS) {
+		fprintf(stderr, "%s: unsupported dump version %u\n", argv[1],
+				h.version);
+		goto out;
+	}
+	if (fread(recs, sizeof(recs[0]), h.count, f) != h.count) {
+		fprintf(stderr, "%s: dump is truncated\n", argv[1]);
+		goto out;
+	}
+
+	uint32_t i;
+	for (i = 0; i < h.count; i++)
+		print_record(&recs[i], recs[h.count - 1].time);
+	ret = 0;
+
+out:
+	fclose(f);
+	return ret;
+}
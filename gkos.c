@@ -5,10 +5,21 @@
 #include <string.h>
 #include <inttypes.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/XInput2.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/extensions/shape.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xinput.h>
 
 #include "chorder.h"
 #include "english_optimized.h"
@@ -50,14 +61,46 @@
  * 63 - Numbers (lowercase->numbers->lowercase)
  */
 
+/*
+ * Returns the path of the named per-user configuration file, creating its
+ * directory if needed.  The directory holds what was typed (macros, the
+ * flight recorder), so it is kept private.  The caller frees the result.
+ */
+char *config_path(const char *name)
+{
+	const char *base = getenv("XDG_CONFIG_HOME");
+	const char *sub = "";
+	if (!base || !*base) {
+		base = getenv("HOME");
+		sub = "/.config";
+		if (!base)
+			return NULL;
+	}
 
+	size_t len = strlen(base) + strlen(sub) + sizeof("/gkos/") +
+		strlen(name);
+	char *path = malloc(len);
+	if (!path)
+		return NULL;
+
+	snprintf(path, len, "%s%s", base, sub);
+	mkdir(path, 0700);
+	strcat(path, "/gkos");
+	// Also tighten a directory left by an older version
+	if (mkdir(path, 0700) && errno == EEXIST)
+		chmod(path, 0700);
+	strcat(path, "/");
+	strcat(path, name);
+	return path;
+}
 
 /*
  * Searches the input hierarchy for a direct-touch device (e.g. a touchscreen,
  * but not most touchpads).  The id parameter gives either a specific device ID
  * to check or one of the special values XIAllDevices or XIAllMasterDevices.
+ * The number of touches the device tracks at once goes in ntouches.
  */
-int init_touch_device(struct kbd_state *state, int id)
+int init_touch_device(struct kbd_state *state, int id, int *ntouches)
 {
 	// Get list of input devices and parameters
 	XIDeviceInfo *di;
@@ -78,7 +121,7 @@ int init_touch_device(struct kbd_state *state, int id)
 			if (tci->type == XITouchClass &&
 					tci->mode == XIDirectTouch) {
 				state->input_dev = di[i].deviceid;
-				state->ntouches = tci->num_touches;
+				*ntouches = tci->num_touches;
 				goto done;
 			}
 		}
@@ -91,32 +134,45 @@ done:
 		return 1;
 	}
 
-	// Allocate space for keeping track of currently held touches and the
-	// corresponding XInput touch event IDs
-	state->touches = calloc(state->ntouches, sizeof(state->touches[0]));
-	state->touchids = calloc(state->ntouches, sizeof(state->touchids[0]));
+	return 0;
+}
 
-	if (!state->touches || !state->touchids) {
-		fprintf(stderr, "Failed to allocate touches/IDs\n");
-		free(state->touchids);
-		free(state->touches);
-		return 1;
-	}
+/*
+ * Returns a monotonic timestamp in microseconds
+ */
+double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
 
-	return 0;
+/*
+ * Adds a sample to a latency measurement
+ */
+void latency_add(struct latency *lat, double us)
+{
+	lat->count++;
+	lat->total += us;
+	if (us > lat->max)
+		lat->max = us;
 }
 
 /*
- * Clean up resources allocated for touch device
+ * Prints a summary of a latency measurement
  */
-void destroy_touch_device(struct kbd_state *state)
+void latency_report(const char *name, const struct latency *lat)
 {
-	free(state->touchids);
-	free(state->touches);
+	if (!lat->count)
+		return;
+	fprintf(stderr, "%s: %lu samples, mean %.1f us, max %.1f us\n", name,
+			lat->count, lat->total / lat->count, lat->max);
 }
 
 /*
- * Establishes an active grab on the touch device
+ * Establishes a grab on the touch device.  Normally this is a passive touch
+ * grab, so touches we reject go on to the windows underneath; in exclusive
+ * mode it is an active grab on the whole device.
  */
 int grab_touches(struct kbd_state *state)
 {
@@ -134,9 +190,15 @@ int grab_touches(struct kbd_state *state)
 	};
 
 	// Grab the touch device
-	return XIGrabDevice(state->dpy, state->input_dev,
-			DefaultRootWindow(state->dpy), CurrentTime, None,
-			XIGrabModeAsync, XIGrabModeAsync, False, &em);
+	if (state->exclusive)
+		return XIGrabDevice(state->dpy, state->input_dev,
+				DefaultRootWindow(state->dpy), CurrentTime,
+				None, XIGrabModeAsync, XIGrabModeAsync, False,
+				&em);
+
+	XIGrabModifiers mods = {.modifiers = XIAnyModifier};
+	return XIGrabTouchBegin(state->dpy, state->input_dev,
+			DefaultRootWindow(state->dpy), False, &em, 1, &mods);
 }
 
 /*
@@ -144,24 +206,87 @@ int grab_touches(struct kbd_state *state)
  */
 void ungrab_touches(struct kbd_state *state)
 {
-	XIUngrabDevice(state->dpy, state->input_dev, CurrentTime);
+	if (state->exclusive) {
+		XIUngrabDevice(state->dpy, state->input_dev, CurrentTime);
+		return;
+	}
+
+	XIGrabModifiers mods = {.modifiers = XIAnyModifier};
+	XIUngrabTouchBegin(state->dpy, state->input_dev,
+			DefaultRootWindow(state->dpy), 1, &mods);
 }
 
 /*
- * Returns the button structure, if any, at the given coordinates
+ * Orders buttons from the outermost ring in
  */
-struct layout_btn *get_layout_btn(struct kbd_state *state, double x, double y)
+static int cmp_btn_radius(const void *a, const void *b)
 {
+	const struct layout_btn *x = *(struct layout_btn * const *) a;
+	const struct layout_btn *y = *(struct layout_btn * const *) b;
+	return y->r1 - x->r1;
+}
+
+/*
+ * Clips the window to the button arcs and their borders, so the compositor
+ * only has the keyboard itself to blend rather than the whole screen.  Each
+ * arc is drawn as a pie slice with the slice inside it cleared again, so the
+ * rings are drawn from the outside in to keep those clears from eating into
+ * rings already drawn.
+ */
+int shape_window(struct kbd_state *state, int width, int height)
+{
+	struct layout_btn **order = malloc(state->nbtns * sizeof(order[0]));
+	if (!order)
+		return 1;
+
 	int i;
+	for (i = 0; i < state->nbtns; i++)
+		order[i] = &state->btns[i];
+	qsort(order, state->nbtns, sizeof(order[0]), cmp_btn_radius);
+
+	Pixmap mask = XCreatePixmap(state->dpy, state->win, width, height, 1);
+	GC gc = XCreateGC(state->dpy, mask, 0, NULL);
+	XSetForeground(state->dpy, gc, 0);
+	XFillRectangle(state->dpy, mask, gc, 0, 0, width, height);
+
 	for (i = 0; i < state->nbtns; i++) {
-		double r = sqrt(pow(x - state->btns[i].cx, 2) + pow(state->btns[i].cy - y, 2));
-		int th = 64 * 180 * atan2(state->btns[i].cy - y, x - state->btns[i].cx) / M_PI;
-		if (r >= state->btns[i].r1 && r <= state->btns[i].r2 &&
-				th >= state->btns[i].th &&
-				th <= state->btns[i].th + state->btns[i].dth)
-			return &state->btns[i];
+		struct layout_btn *btn = order[i];
+		XSetForeground(state->dpy, gc, 1);
+		XFillArc(state->dpy, mask, gc,
+				btn->cx - btn->r2, btn->cy - btn->r2,
+				2*btn->r2, 2*btn->r2, btn->th, btn->dth);
+		XSetForeground(state->dpy, gc, 0);
+		XFillArc(state->dpy, mask, gc,
+				btn->cx - btn->r1, btn->cy - btn->r1,
+				2*btn->r1, 2*btn->r1, btn->th, btn->dth);
+	}
+
+	// The borders are stroked on the edges, so keep their pixels too
+	XSetForeground(state->dpy, gc, 1);
+	for (i = 0; i < state->nbtns; i++) {
+		struct layout_btn *btn = order[i];
+		XDrawArc(state->dpy, mask, gc,
+				btn->cx - btn->r2, btn->cy - btn->r2,
+				2*btn->r2, 2*btn->r2, btn->th, btn->dth);
+		XDrawArc(state->dpy, mask, gc,
+				btn->cx - btn->r1, btn->cy - btn->r1,
+				2*btn->r1, 2*btn->r1, btn->th, btn->dth);
+		double th[2] = {btn->th, btn->th + btn->dth};
+		int j;
+		for (j = 0; j < 2; j++)
+			XDrawLine(state->dpy, mask, gc,
+					btn->cx + btn->r2 * cos(M_PI * th[j] / 11520.0),
+					btn->cy - btn->r2 * sin(M_PI * th[j] / 11520.0),
+					btn->cx + btn->r1 * cos(M_PI * th[j] / 11520.0),
+					btn->cy - btn->r1 * sin(M_PI * th[j] / 11520.0));
 	}
-	return NULL;
+
+	XShapeCombineMask(state->dpy, state->win, ShapeBounding, 0, 0, mask,
+			ShapeSet);
+	XFreeGC(state->dpy, gc);
+	XFreePixmap(state->dpy, mask);
+	free(order);
+	return 0;
 }
 
 /*
@@ -170,8 +295,6 @@ struct layout_btn *get_layout_btn(struct kbd_state *state, double x, double y)
 int create_window(struct kbd_state *state, const struct layout *lt,
 		int num_btns)
 {
-	int i;
-
 	// Allocate space for keys on both sides
 	state->btns = calloc(num_btns * 2, sizeof(state->btns[0]));
 	if (!state->btns)
@@ -191,6 +314,9 @@ int create_window(struct kbd_state *state, const struct layout *lt,
 	Screen *scr = DefaultScreenOfDisplay(state->dpy);
 	int swidth = WidthOfScreen(scr);
 	int sheight = HeightOfScreen(scr);
+	state->layout = lt;
+	state->swidth = swidth;
+	state->sheight = sheight;
 	XSetWindowAttributes attrs = {
 		.background_pixel = TRANSPARENT,
 		.border_pixel = TRANSPARENT,
@@ -202,26 +328,28 @@ int create_window(struct kbd_state *state, const struct layout *lt,
 			state->xvi.depth, InputOutput, state->xvi.visual,
 			CWBackPixel | CWBorderPixel | CWOverrideRedirect | CWColormap, &attrs);
 	XSetClassHint(state->dpy, state->win, class);
-	XSelectInput(state->dpy, state->win, StructureNotifyMask);
+	XSelectInput(state->dpy, state->win,
+			StructureNotifyMask | ExposureMask);
 
 	// Free the class hint
 	XFree(class);
 
+	// Unless we own every touch, let input fall through the window to
+	// whatever is underneath
+	if (!state->exclusive)
+		XShapeCombineRectangles(state->dpy, state->win, ShapeInput,
+				0, 0, NULL, 0, ShapeSet, Unsorted);
+
 	// Calculate button positions in grid
-	for (i = 0; i < state->nbtns / 2; i++) {
-		// Index of mirrored key
-		int m = i + state->nbtns / 2;
-
-		state->btns[i].r1 = state->btns[m].r1 = IR + lt[i].row * DR;
-		state->btns[i].r2 = state->btns[m].r2 = state->btns[i].r1 + DR;
-		state->btns[i].th = 5760 - (lt[i].th + lt[i].dth) * DTH;
-		state->btns[m].th = 5760 + lt[i].th * DTH;
-		state->btns[i].dth = state->btns[m].dth = lt[i].dth * DTH;
-		state->btns[i].cx = CX;
-		state->btns[m].cx = swidth - 1 - CX;
-		state->btns[i].cy = state->btns[m].cy = CY;
-		state->btns[i].bits = lt[i].bits;
-		state->btns[m].bits = lt[i].bits << 3;
+	state->hand_bits = layout_place(state->btns, lt, num_btns, swidth);
+	touch_set_layout(&state->touch, state->btns, state->nbtns,
+			state->hand_bits);
+
+	// Only the buttons need to be composited
+	if (shape_window(state, swidth, sheight)) {
+		fprintf(stderr, "Failed to shape window\n");
+		free(state->btns);
+		return 1;
 	}
 
 	// Grab touch events for the new window
@@ -260,16 +388,159 @@ void destroy_window(struct kbd_state *state)
 }
 
 /*
- * Calculate the bits corresponding to the currently touched buttons
+ * Creates the small input-only window in the corner of the screen which
+ * brings back the keyboard when touched while it is hidden
  */
-uint8_t get_pressed_bits(struct kbd_state *state)
+int create_handle(struct kbd_state *state)
 {
-	uint8_t bits = 0;
+	Screen *scr = DefaultScreenOfDisplay(state->dpy);
+	XSetWindowAttributes attrs = {
+		.override_redirect = True,
+	};
+	state->handle = XCreateWindow(state->dpy, DefaultRootWindow(state->dpy),
+			0, HeightOfScreen(scr) - HANDLE_SIZE,
+			HANDLE_SIZE, HANDLE_SIZE, 0, 0, InputOnly,
+			CopyFromParent, CWOverrideRedirect, &attrs);
+
+	// Listen (without grabbing) for touches on the handle
+	unsigned char mask[XIMaskLen(XI_LASTEVENT)];
+	memset(mask, 0, sizeof(mask));
+	XISetMask(mask, XI_TouchBegin);
+	XISetMask(mask, XI_TouchUpdate);
+	XISetMask(mask, XI_TouchEnd);
+
+	XIEventMask em = {
+		.mask = mask,
+		.mask_len = sizeof(mask),
+		.deviceid = state->input_dev,
+	};
+	return XISelectEvents(state->dpy, state->handle, &em, 1) != Success;
+}
+
+/*
+ * Writes a short label for what a keymap entry does, returning its length
+ */
+int label_text(const struct chord_entry *e, char *buf)
+{
+	const char *name;
+
+	switch (e->type) {
+		case TYPE_KEY:
+		case TYPE_MOD:
+		case TYPE_MODLOCK:
+			// Printable characters stand for themselves
+			if (e->arg.code > XK_space && e->arg.code <= XK_asciitilde) {
+				buf[0] = e->arg.code;
+				return 1;
+			}
+			name = XKeysymToString(e->arg.code);
+			break;
+		case TYPE_MAP:
+		case TYPE_MAPLOCK:
+			return snprintf(buf, LABEL_LEN + 1, "map%u", e->arg.map);
+		case TYPE_MACRO:
+			name = "macro";
+			break;
+		default:
+			return 0;
+	}
+	if (!name)
+		return 0;
+
+	// Drop the side from modifier names
+	int len = strlen(name);
+	if (len > 2 && (!strcmp(name + len - 2, "_L") ||
+				!strcmp(name + len - 2, "_R")))
+		len -= 2;
+	if (len > LABEL_LEN)
+		len = LABEL_LEN;
+	memcpy(buf, name, len);
+	return len;
+}
+
+/*
+ * Rasterizes the label of every button in every map into a stencil atlas up
+ * front, so drawing a label later is just a fill through the stencil
+ */
+int create_labels(struct kbd_state *state)
+{
+	struct chorder *kbd = &state->chorder;
+
+	XFontStruct *font = XLoadQueryFont(state->dpy, LABEL_FONT);
+	if (!font) {
+		fprintf(stderr, "Could not load font %s\n", LABEL_FONT);
+		return 1;
+	}
+
+	int width = state->nbtns * LABEL_W, height = kbd->maps * LABEL_H;
+	state->labels = XCreatePixmap(state->dpy, state->win, width, height, 1);
+	GC gc = XCreateGC(state->dpy, state->labels, 0, NULL);
+	XSetForeground(state->dpy, gc, 0);
+	XFillRectangle(state->dpy, state->labels, gc, 0, 0, width, height);
+	XSetForeground(state->dpy, gc, 1);
+	XSetFont(state->dpy, gc, font->fid);
+
+	unsigned long map;
 	int i;
-	for (i = 0; i < state->ntouches; i++)
-		if (state->touchids[i] && state->touches[i])
-			bits |= state->touches[i]->bits;
-	return bits;
+	for (map = 0; map < kbd->maps; map++) {
+		for (i = 0; i < state->nbtns; i++) {
+			const struct chord_entry *e = chorder_get_entry(kbd,
+					map, state->btns[i].bits);
+			char text[LABEL_LEN + 1];
+			int len = e ? label_text(e, text) : 0;
+			if (!len)
+				continue;
+			int w = XTextWidth(font, text, len);
+			XDrawString(state->dpy, state->labels, gc,
+					i * LABEL_W + (LABEL_W - w) / 2,
+					map * LABEL_H + (LABEL_H + font->ascent -
+						font->descent) / 2,
+					text, len);
+		}
+	}
+	XFreeGC(state->dpy, gc);
+	XFreeFont(state->dpy, font);
+
+	uint32_t values[] = {LABEL_COLOR, state->labels};
+	state->label_gc = xcb_generate_id(state->conn);
+	xcb_create_gc(state->conn, state->label_gc, state->win,
+			XCB_GC_FOREGROUND | XCB_GC_CLIP_MASK, values);
+	return 0;
+}
+
+/*
+ * Releases the label atlas
+ */
+void destroy_labels(struct kbd_state *state)
+{
+	if (!state->labels)
+		return;
+	xcb_free_gc(state->conn, state->label_gc);
+	XFreePixmap(state->dpy, state->labels);
+	state->labels = None;
+}
+
+/*
+ * Draws a button's label for the current map, centered in its arc
+ */
+void draw_label(struct kbd_state *state, struct layout_btn *btn)
+{
+	if (!state->labels)
+		return;
+
+	double r = (btn->r1 + btn->r2) / 2.0;
+	double th = M_PI * (btn->th + btn->dth / 2.0) / 11520.0;
+	int x = btn->cx + r * cos(th) - LABEL_W / 2;
+	int y = btn->cy - r * sin(th) - LABEL_H / 2;
+	int cellx = (btn - state->btns) * LABEL_W;
+	int celly = state->chorder.current_map * LABEL_H;
+
+	uint32_t origin[] = {x - cellx, y - celly};
+	xcb_rectangle_t rect = {x, y, LABEL_W, LABEL_H};
+	xcb_change_gc(state->conn, state->label_gc,
+			XCB_GC_CLIP_ORIGIN_X | XCB_GC_CLIP_ORIGIN_Y, origin);
+	state->seq = xcb_poly_fill_rectangle(state->conn, state->win,
+			state->label_gc, 1, &rect).sequence;
 }
 
 /*
@@ -277,22 +548,7 @@ uint8_t get_pressed_bits(struct kbd_state *state)
  */
 void highlight_win(struct kbd_state *state, struct layout_btn *btn, int on)
 {
-	// Fill
-	XSetForeground(state->dpy, state->gc,
-			on ? PRESSED_COLOR : UNPRESSED_COLOR);
-	XFillArc(state->dpy, state->win, state->gc,
-			btn->cx - btn->r2, btn->cy - btn->r2,
-			2*btn->r2, 2*btn->r2,
-			btn->th, btn->dth);
-	XSetForeground(state->dpy, state->gc, TRANSPARENT);
-	XFillArc(state->dpy, state->win, state->gc,
-			btn->cx - btn->r1, btn->cy - btn->r1,
-			2*btn->r1, 2*btn->r1,
-			btn->th, btn->dth);
-
-	// Border
-	XSetForeground(state->dpy, state->gc, BORDER_COLOR);
-	XArc arcs[] = {
+	xcb_arc_t arcs[] = {
 		{
 			.x = btn->cx - btn->r2, .y = btn->cy - btn->r2,
 			.width = 2*btn->r2, .height = 2*btn->r2,
@@ -304,9 +560,22 @@ void highlight_win(struct kbd_state *state, struct layout_btn *btn, int on)
 			.angle1 = btn->th, .angle2 = btn->dth,
 		},
 	};
-	XDrawArcs(state->dpy, state->win, state->gc,
-			arcs, sizeof(arcs)/sizeof(arcs[0]));
-	XSegment segs[] = {
+	uint32_t color;
+
+	// Fill
+	color = on ? PRESSED_COLOR : UNPRESSED_COLOR;
+	xcb_change_gc(state->conn, state->gc, XCB_GC_FOREGROUND, &color);
+	xcb_poly_fill_arc(state->conn, state->win, state->gc, 1, &arcs[0]);
+	color = TRANSPARENT;
+	xcb_change_gc(state->conn, state->gc, XCB_GC_FOREGROUND, &color);
+	xcb_poly_fill_arc(state->conn, state->win, state->gc, 1, &arcs[1]);
+
+	// Border
+	color = BORDER_COLOR;
+	xcb_change_gc(state->conn, state->gc, XCB_GC_FOREGROUND, &color);
+	xcb_poly_arc(state->conn, state->win, state->gc,
+			sizeof(arcs)/sizeof(arcs[0]), arcs);
+	xcb_segment_t segs[] = {
 		{
 			.x1 = btn->cx + btn->r2 * cos(M_PI * btn->th / 11520.0),
 			.x2 = btn->cx + btn->r1 * cos(M_PI * btn->th / 11520.0),
@@ -320,64 +589,179 @@ void highlight_win(struct kbd_state *state, struct layout_btn *btn, int on)
 			.y2 = btn->cy - btn->r1 * sin(M_PI * (btn->th+btn->dth) / 11520.0),
 		},
 	};
-	XDrawSegments(state->dpy, state->win, state->gc,
-			segs, sizeof(segs)/sizeof(segs[0]));
+	state->seq = xcb_poly_segment(state->conn, state->win, state->gc,
+			sizeof(segs)/sizeof(segs[0]), segs).sequence;
+
+	draw_label(state, btn);
 }
 
 /*
- * Highlight buttons according to what is currently pressed
+ * Redraws the buttons whose highlight or label has changed since the last
+ * frame, or all of them if the window needs repainting
  */
-void update_display(struct kbd_state *state)
+void redraw(struct kbd_state *state, double now)
 {
-	uint8_t bits = get_pressed_bits(state);
+	uint32_t bits = touch_pressed_bits(&state->touch);
+	int all = state->redraw_all ||
+		state->shown_map != state->chorder.current_map;
 	int i;
 	for (i = 0; i < state->nbtns; i++) {
-		int on = (bits & state->btns[i].bits) == state->btns[i].bits;
-		highlight_win(state, &state->btns[i], on);
+		uint32_t b = state->btns[i].bits;
+		int on = (bits & b) == b;
+		if (all || on != ((state->shown_bits & b) == b))
+			highlight_win(state, &state->btns[i], on);
 	}
+	xcb_flush(state->conn);
+
+	state->shown_bits = bits;
+	state->shown_map = state->chorder.current_map;
+	state->redraw_all = 0;
+	state->redraw_next = 0;
+	state->last_frame = now;
 }
 
 /*
- * Remember a button as "touched" at the start of a touch event
+ * Schedules the display to catch up with what is currently pressed.  Changes
+ * are drawn together at most once a frame: right away if the last frame was
+ * long enough ago, or else when the next one is due.  Nothing here holds up
+ * key injection.
  */
-int add_touch(struct kbd_state *state, struct layout_btn *btn, int touchid)
+void update_display(struct kbd_state *state)
 {
-	int i;
-	for (i = 0; i < state->ntouches && state->touchids[i]; i++)
-		;
-	if (i >= state->ntouches) {
-		fprintf(stderr, "No open touch slots found\n");
-		return 1;
-	}
+	if (state->redraw_next)
+		return;
 
-	state->touches[i] = btn;
-	state->touchids[i] = touchid;
+	double next = state->last_frame + 1e6 / FRAME_RATE;
+	double now = now_us();
+	state->redraw_next = next > now ? next : now;
+}
+
+/*
+ * Schedules a redraw of every button, e.g. after the window was exposed
+ */
+void invalidate_display(struct kbd_state *state)
+{
+	state->redraw_all = 1;
 	update_display(state);
-	return 0;
 }
 
 /*
- * Find the touch index corresponding to the given touch event ID
+ * Hides the keyboard, keeping everything else ready to show it again
  */
-int get_touch_index(struct kbd_state *state, int touchid)
+void hide_keyboard(struct kbd_state *state)
 {
-	int i;
-	for (i = 0; i < state->ntouches; i++)
-		if (state->touchids[i] == touchid)
-			return i;
+	if (state->hidden)
+		return;
 
-	return -1;
+	ungrab_touches(state);
+	XUnmapWindow(state->dpy, state->win);
+	XMapRaised(state->dpy, state->handle);
+	XFlush(state->dpy);
+	touch_clear(&state->touch);
+	state->hidden = 1;
 }
 
 /*
- * Unregister a touched button when the touch is released
+ * Shows the keyboard again after it was hidden.  This does not wait for the
+ * window to be mapped; the time until it is gets recorded when MapNotify
+ * arrives.
  */
-int remove_touch(struct kbd_state *state, int index)
+void show_keyboard(struct kbd_state *state)
 {
-	state->touches[index] = NULL;
-	state->touchids[index] = 0;
-	update_display(state);
-	return 0;
+	if (!state->hidden)
+		return;
+
+	state->show_start = now_us();
+	XUnmapWindow(state->dpy, state->handle);
+	XMapRaised(state->dpy, state->win);
+	if (grab_touches(state))
+		fprintf(stderr, "Failed to grab touch event\n");
+	invalidate_display(state);
+	XFlush(state->dpy);
+	state->hidden = 0;
+}
+
+/*
+ * Dumps the flight recorder to a file of its own, named for the reason and
+ * the time, so neither later snapshots nor the dump at exit overwrite it
+ */
+void flight_snapshot(struct kbd_state *state, const char *why)
+{
+	if (!state->flight_path ||
+			state->flight_snapshots >= FLIGHT_MAX_SNAPSHOTS)
+		return;
+
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S",
+			localtime_r(&now, &tm));
+
+	size_t len = strlen(state->flight_path) + strlen(why) +
+		strlen(stamp) + sizeof("--");
+	char *path = malloc(len);
+	if (!path)
+		return;
+	snprintf(path, len, "%s-%s-%s", state->flight_path, why, stamp);
+	if (!flight_dump(&state->flight, path)) {
+		fprintf(stderr, "Flight recorder saved to %s\n", path);
+		state->flight_snapshots++;
+	}
+	free(path);
+}
+
+/*
+ * Commits the chord formed by the given bits of the currently held touches,
+ * feeding those touches to calibration.  A chord that was held commits its
+ * long-press variant if it has one.
+ */
+int commit_chord(struct kbd_state *state, uint32_t bits, unsigned long time,
+		int held)
+{
+	// A BackSpace or undo chord tells calibration the previous chord was
+	// wrong
+	const struct chord_entry *e = NULL;
+	if (held)
+		e = chorder_get_long(&state->chorder,
+				state->chorder.current_map, bits);
+	if (!e)
+		e = chorder_get_entry(&state->chorder,
+				state->chorder.current_map, bits);
+	int undo = e && (e->type == TYPE_UNDO ||
+			(e->type == TYPE_KEY && e->arg.code == XK_BackSpace));
+
+	struct calib_touch ct[CALIB_MAX_TOUCHES];
+	int i, n = 0;
+	const struct touch_tracker *t = &state->touch;
+	for (i = 0; i < t->ntouches && n < CALIB_MAX_TOUCHES; i++) {
+		if (!t->touchids[i] || !t->touches[i] ||
+				!(t->touches[i]->bits & bits))
+			continue;
+		ct[n++] = (struct calib_touch) {
+			.btn = t->touches[i] - state->btns,
+			.x = t->touchpts[i].x,
+			.y = t->touchpts[i].y,
+		};
+	}
+	calib_chord(&state->calib, ct, n, undo, time);
+	stats_chord(&state->stats, state->chorder.current_map, bits, undo,
+			time);
+
+	flight_log(&state->flight, FLIGHT_CHORD, bits, held, 0);
+	int rv;
+	if (held)
+		rv = chorder_press_long(&state->chorder, bits);
+	else
+		rv = chorder_press(&state->chorder, bits);
+	flight_chorder(&state->flight, &state->chorder);
+	if (rv) {
+		// Keep a record of what led up to the failure
+		flight_log(&state->flight, FLIGHT_ERROR, bits, 0, 0);
+		flight_snapshot(state, "error");
+	}
+	metrics_chord(&state->metrics, &state->chorder,
+			undo || !e || e->type == TYPE_NONE);
+	return rv;
 }
 
 /*
@@ -386,8 +770,128 @@ int remove_touch(struct kbd_state *state, int index)
 void handle_press(void *arg, unsigned long sym, int press)
 {
 	struct kbd_state *state = arg;
-	unsigned long code = XKeysymToKeycode(state->dpy, sym);
-	XTestFakeKeyEvent(state->dpy, code, press, CurrentTime);
+	flight_log(&state->flight, FLIGHT_KEY, sym, press, 0);
+	state->seq = inject_key(&state->inject, sym, press);
+}
+
+/*
+ * Estimates the current X server time from the last event we received
+ */
+unsigned long server_time(struct kbd_state *state, double now)
+{
+	return state->last_time + (unsigned long) ((now - state->last_us) / 1e3);
+}
+
+/*
+ * Notes that a chord was committed in response to an event which arrived at
+ * the given time, unless one is already waiting to be flushed
+ */
+void start_chord_latency(struct kbd_state *state, double us)
+{
+	if (state->chord_pending)
+		return;
+	state->chord_us = us;
+	state->chord_pending = 1;
+}
+
+/*
+ * Sends everything buffered to the server, recording how long the chords
+ * committed since the last flush took to get there and how many requests
+ * they took, counting from the touch which began them
+ */
+void flush_requests(struct kbd_state *state)
+{
+	xcb_flush(state->conn);
+	if (!state->chord_pending)
+		return;
+	metrics_latency(&state->metrics, now_us() - state->chord_us);
+	latency_add(&state->chord_requests, state->seq - state->chord_seq);
+	state->chord_seq = state->seq;
+	state->chord_pending = 0;
+}
+
+/*
+ * Commits a chord the touch tracker recognized
+ */
+int touch_commit(void *arg, uint32_t bits, unsigned long time,
+		enum touch_commit how)
+{
+	struct kbd_state *state = arg;
+	int rv = commit_chord(state, bits, time, how == TOUCH_HELD);
+	start_chord_latency(state, how == TOUCH_RELEASED ? state->last_us :
+			now_us());
+	return rv;
+}
+
+/*
+ * Types the key for a swipe the touch tracker recognized
+ */
+int touch_swipe(void *arg, KeySym sym)
+{
+	struct kbd_state *state = arg;
+	struct chord_entry e = {.type = TYPE_KEY, .arg.code = sym};
+	int rv = chorder_press_entry(&state->chorder, &e);
+	flight_chorder(&state->flight, &state->chorder);
+	return rv;
+}
+
+/*
+ * Types one repeat of an autorepeating key, with the one-shot mods of the
+ * chord which started it.  Each repeat is a full press and release of the
+ * mods and key, so no key is ever left down.
+ */
+void touch_repeat(void *arg, KeySym sym)
+{
+	struct kbd_state *state = arg;
+	const struct touch_tracker *t = &state->touch;
+	int i;
+
+	for (i = 0; i < t->repeat_nmods; i++)
+		handle_press(state, t->repeat_mods[i], 1);
+	handle_press(state, sym, 1);
+	handle_press(state, sym, 0);
+	for (i = t->repeat_nmods - 1; i >= 0; i--)
+		handle_press(state, t->repeat_mods[i], 0);
+}
+
+static const struct touch_ops touch_ops = {
+	.commit = touch_commit,
+	.swipe = touch_swipe,
+	.repeat = touch_repeat,
+};
+
+/*
+ * Returns the time of the next timer to expire, or 0 if none is pending
+ */
+double next_timer(struct kbd_state *state)
+{
+	double next = state->touch.repeat_next;
+	if (state->stats_next && (!next || state->stats_next < next))
+		next = state->stats_next;
+	if (state->redraw_next && (!next || state->redraw_next < next))
+		next = state->redraw_next;
+	return next;
+}
+
+/*
+ * Runs any timers which have expired
+ */
+void run_timers(struct kbd_state *state)
+{
+	double now = now_us();
+	if (state->touch.repeat_next && state->touch.repeat_next <= now)
+		touch_run_hold(&state->touch, now, server_time(state, now));
+	if (state->redraw_next && state->redraw_next <= now) {
+		// Showing the keyboard again repaints it all anyway
+		if (state->hidden)
+			state->redraw_next = 0;
+		else
+			redraw(state, now);
+	}
+	if (state->stats_next && state->stats_next <= now) {
+		stats_save(&state->stats, &state->chorder, state->stats_path);
+		state->stats_next = now + STATS_SNAPSHOT_MS * 1e3;
+	}
 }
 
 /*
@@ -397,65 +901,117 @@ int handle_xi_event(struct kbd_state *state, XIDeviceEvent *ev)
 {
 	struct layout_btn *btn;
 	int idx;
+	double t0;
+
+	// While hidden, the only touches we see are on the handle
+	if (ev->event == state->handle && state->handle) {
+		if (ev->evtype == XI_TouchBegin)
+			show_keyboard(state);
+		return 0;
+	}
+
+	state->last_time = ev->time;
+	state->last_us = now_us();
 
 	switch (ev->evtype) {
 		case XI_TouchBegin:
-			// Bring window to top if it isn't
-			XRaiseWindow(state->dpy, state->win);
+			t0 = state->last_us;
+
+			// Find which button was touched
+			btn = touch_hit(&state->touch, ev->root_x, ev->root_y);
+			flight_log(&state->flight, FLIGHT_TOUCH_BEGIN, ev->detail,
+					(int32_t) ev->root_x,
+					(int32_t) ev->root_y);
+			flight_log(&state->flight, FLIGHT_HIT, ev->detail,
+					btn ? (uint32_t) (btn - state->btns) :
+					FLIGHT_MISS, 0);
+
+			// Pass touches outside the keyboard on to other
+			// clients as soon as possible
+			if (!btn && !state->exclusive) {
+				state->seq = xcb_input_xi_allow_events(
+						state->conn, XCB_CURRENT_TIME,
+						state->input_dev,
+						XCB_INPUT_EVENT_MODE_REJECT_TOUCH,
+						ev->detail, ev->event).sequence;
+				xcb_flush(state->conn);
+				latency_add(&state->reject_latency,
+						now_us() - t0);
+				break;
+			}
+
+			// A chord's requests are counted from its first touch,
+			// unless an earlier chord's are still being counted
+			if (!state->chord_pending &&
+					!touch_pressed_bits(&state->touch))
+				state->chord_seq = state->seq;
 
 			// Claim the touch event
-			XIAllowTouchEvents(state->dpy, state->input_dev,
-					ev->detail, ev->event, XIAcceptTouch);
+			state->seq = xcb_input_xi_allow_events(state->conn,
+					XCB_CURRENT_TIME, state->input_dev,
+					XCB_INPUT_EVENT_MODE_ACCEPT_TOUCH,
+					ev->detail, ev->event).sequence;
+			xcb_flush(state->conn);
+			latency_add(&state->accept_latency, now_us() - t0);
+			metrics_touch(&state->metrics);
 
-			// Find and record which button was touched
-			btn = get_layout_btn(state, ev->root_x, ev->root_y);
-			if (add_touch(state, btn, ev->detail))
+			// Bring window to top if it isn't
+			uint32_t stack = XCB_STACK_MODE_ABOVE;
+			state->seq = xcb_configure_window(state->conn,
+					state->win, XCB_CONFIG_WINDOW_STACK_MODE,
+					&stack).sequence;
+
+			// Record the touch, even outside a defined button so
+			// that we know which touches missed
+			if (touch_begin(&state->touch, btn, ev->detail,
+						ev->root_x, ev->root_y,
+						state->last_us))
 				return 1;
-
-			// Comes after add_touch so we remember which touches
-			// were outside a defined button
-			if (!btn)
-				break;
-
-			state->active = 1;
+			update_display(state);
 			break;
 
 		case XI_TouchEnd:
+			flight_log(&state->flight, FLIGHT_TOUCH_END, ev->detail,
+					0, 0);
+
 			// Find which touch was released
-			idx = get_touch_index(state, ev->detail);
+			idx = touch_index(&state->touch, ev->detail);
 			if (idx < 0) {
+				// Rejected touches still end here
+				if (!state->exclusive)
+					break;
 				fprintf(stderr, "Released window was not touched\n");
 				return 1;
 			}
 
-			// Shut down on double-touch outside keyboard
-			int misses = 0;
-			int i;
-			for (i = 0; i < state->ntouches; i++) {
-				if (state->touchids[i] && !state->touches[i])
-					misses++;
-				if (misses >= 2)
-					break;
-			}
-			if (misses >= 2) {
-				state->shutdown = 1;
+			// Shut down on two touches held outside the keyboard.
+			// In exclusive mode that is a double tap anywhere off
+			// it; touches landing off it are never ours otherwise,
+			// so there it takes two fingers slid off the keyboard
+			if (touch_dismissed(&state->touch)) {
+				// In daemon mode, just get out of the way
+				if (state->daemon)
+					hide_keyboard(state);
+				else
+					state->shutdown = 1;
 				break;
 			}
 
 			// If this is the first release after a touch, generate
 			// key event
-			if (state->active) {
-				chorder_press(&state->chorder,
-						get_pressed_bits(state));
-				state->active = 0;
-			}
-
-			// Update touch tracking
-			if (remove_touch(state, idx))
+			if (touch_end(&state->touch, idx, ev->time))
 				return 1;
+			update_display(state);
 			break;
 
 		case XI_TouchUpdate:
+			idx = touch_index(&state->touch, ev->detail);
+			if (idx < 0)
+				break;
+			if (touch_move(&state->touch, idx, ev->root_x,
+						ev->root_y, state->last_us))
+				return 1;
+			update_display(state);
 			break;
 
 		default:
@@ -466,29 +1022,223 @@ int handle_xi_event(struct kbd_state *state, XIDeviceEvent *ev)
 }
 
 /*
- * Main event handling loop
+ * Write end of the pipe used to wake the event loop from signal handlers
  */
-int event_loop(struct kbd_state *state)
+static int signal_pipe = -1;
+
+/*
+ * Signal handler which passes the signal number on to the event loop
+ */
+static void forward_signal(int sig)
 {
-	XEvent ev;
-	XGenericEventCookie *cookie = &ev.xcookie;
-
-	while (!state->shutdown && XNextEvent(state->dpy, &ev) == Success) {
-		if (ev.type == GenericEvent &&
-				cookie->extension == state->xi_opcode &&
-				XGetEventData(state->dpy, cookie)) {
-			// GenericEvent from XInput
-			handle_xi_event(state, cookie->data);
-			XFreeEventData(state->dpy, cookie);
-		} else {
-			// Regular event type
-			switch (ev.type) {
-				case MappingNotify:
-					XRefreshKeyboardMapping(&ev.xmapping);
+	int saved = errno;
+	unsigned char c = sig;
+	// If the pipe is full, the loop already has wakeups pending
+	ssize_t rv = write(signal_pipe, &c, 1);
+	(void) rv;
+	errno = saved;
+}
+
+/*
+ * Sets up the pipe and handlers for signals the event loop responds to:
+ * SIGUSR1 toggles the keyboard, SIGUSR2 dumps the flight recorder, and
+ * SIGINT/SIGTERM shut down cleanly
+ */
+int init_signals(int fds[2])
+{
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	signal_pipe = fds[1];
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = forward_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	return 0;
+}
+
+/*
+ * Handles any signals forwarded through the pipe
+ */
+void handle_signals(struct kbd_state *state, int fd)
+{
+	unsigned char sig;
+	while (read(fd, &sig, 1) == 1) {
+		switch (sig) {
+			case SIGUSR1:
+				if (!state->daemon)
 					break;
-				default:
-					fprintf(stderr, "regular event %d\n", ev.type);
+				if (state->hidden)
+					show_keyboard(state);
+				else
+					hide_keyboard(state);
+				break;
+			case SIGUSR2:
+				flight_snapshot(state, "signal");
+				break;
+			case SIGINT:
+			case SIGTERM:
+				state->shutdown = 1;
+				break;
+		}
+	}
+}
+
+/*
+ * Fits the keyboard to a new screen size.  The buttons are placed again in
+ * the same slots, so touches in progress still refer to the right ones, and
+ * the label atlas is indexed by slot rather than position, so it stays as it
+ * is.
+ */
+int resize_window(struct kbd_state *state, int swidth, int sheight)
+{
+	if (swidth == state->swidth && sheight == state->sheight)
+		return 0;
+	state->swidth = swidth;
+	state->sheight = sheight;
+
+	// Place the buttons for the new size, keeping what calibration has
+	// learned
+	layout_place(state->btns, state->layout, state->nbtns / 2, swidth);
+	calib_apply(&state->calib);
+
+	// Touches held back for calibration were measured against the old
+	// positions, so they can't be learned from
+	state->calib.npending = 0;
+
+	uint32_t size[] = {swidth, sheight};
+	state->seq = xcb_configure_window(state->conn, state->win,
+			XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+			size).sequence;
+	if (shape_window(state, swidth, sheight))
+		return 1;
+	if (state->handle) {
+		uint32_t y = sheight - HANDLE_SIZE;
+		state->seq = xcb_configure_window(state->conn, state->handle,
+				XCB_CONFIG_WINDOW_Y, &y).sequence;
+	}
+
+	invalidate_display(state);
+	xcb_flush(state->conn);
+	return 0;
+}
+
+/*
+ * Handles one event from the X server
+ */
+void handle_event(struct kbd_state *state, XEvent *ev)
+{
+	XGenericEventCookie *cookie = &ev->xcookie;
+
+	if (ev->type == GenericEvent &&
+			cookie->extension == state->xi_opcode &&
+			XGetEventData(state->dpy, cookie)) {
+		// GenericEvent from XInput
+		handle_xi_event(state, cookie->data);
+		XFreeEventData(state->dpy, cookie);
+		return;
+	}
+
+	// The screen was resized or rotated
+	if (state->randr_event &&
+			ev->type == state->randr_event + RRScreenChangeNotify) {
+		XRRUpdateConfiguration(ev);
+		Screen *scr = DefaultScreenOfDisplay(state->dpy);
+		if (resize_window(state, WidthOfScreen(scr),
+					HeightOfScreen(scr)))
+			fprintf(stderr, "Failed to fit keyboard to screen\n");
+		return;
+	}
+
+	// Regular event type
+	switch (ev->type) {
+		case MappingNotify:
+			XRefreshKeyboardMapping(&ev->xmapping);
+			inject_forget_keycodes(&state->inject);
+			break;
+		case Expose:
+			if (ev->xexpose.count == 0)
+				invalidate_display(state);
+			break;
+		case MapNotify:
+			// Keyboard is back on screen after being hidden
+			if (ev->xmap.window == state->win && state->show_start) {
+				latency_add(&state->show_latency,
+						now_us() - state->show_start);
+				state->show_start = 0;
 			}
+			break;
+		case UnmapNotify:
+		case ConfigureNotify:
+			break;
+		default:
+			fprintf(stderr, "regular event %d\n", ev->type);
+	}
+}
+
+/*
+ * Main event handling loop
+ */
+int event_loop(struct kbd_state *state, int sigfd)
+{
+	XEvent ev;
+	struct pollfd fds[2 + CTL_MAX_FDS] = {
+		{.fd = ConnectionNumber(state->dpy), .events = POLLIN},
+		{.fd = sigfd, .events = POLLIN},
+	};
+
+	while (!state->shutdown) {
+		// Drain everything Xlib has already read before sleeping
+		while (!state->shutdown && XPending(state->dpy)) {
+			XNextEvent(state->dpy, &ev);
+			handle_event(state, &ev);
+		}
+		run_timers(state);
+		if (state->shutdown)
+			break;
+
+		// Everything this batch of events and timers produced goes out
+		// at once
+		flush_requests(state);
+
+		// Sleep until there is input or the next timer is due
+		int timeout = -1;
+		double next = next_timer(state);
+		if (next) {
+			double ms = ceil((next - now_us()) / 1e3);
+			timeout = ms > 0 ? ms : 0;
+		}
+
+		int nctl = ctl_pollfds(&state->ctl, fds + 2);
+		if (poll(fds, 2 + nctl, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+		if (fds[1].revents & POLLIN)
+			handle_signals(state, sigfd);
+
+		// Send the keys for any chords injected over the control socket.
+		// These are scripted rather than typed, so they stay out of the
+		// usage statistics, calibration and chord/misfire counts, and
+		// only their latency is recorded
+		double t0 = now_us();
+		if (!state->chord_pending)
+			state->chord_seq = state->seq;
+		if (ctl_handle(&state->ctl, fds + 2, nctl, &state->chorder)) {
+			flight_chorder(&state->flight, &state->chorder);
+			start_chord_latency(state, t0);
+			XFlush(state->dpy);
+			flush_requests(state);
 		}
 	}
 
@@ -501,14 +1251,68 @@ int event_loop(struct kbd_state *state)
 int main(int argc, char **argv)
 {
 	int ret = 0;
+	double start = now_us();
 
 	struct kbd_state state;
-	state.active = 0;
-	state.shutdown = 0;
+	memset(&state, 0, sizeof(state));
+
+	// Parse options
+	int opt;
+	const char *ctl_path = NULL;
+	state.ctl.fd = -1;
+	state.touch.repeat_delay = REPEAT_DELAY;
+	state.touch.repeat_rate = REPEAT_RATE;
+	while ((opt = getopt(argc, argv, "dpr:s:x")) != -1) {
+		switch (opt) {
+			case 'r':
+				// Autorepeat delay (ms) and rate (Hz)
+				if (sscanf(optarg, "%d,%d",
+							&state.touch.repeat_delay,
+							&state.touch.repeat_rate) != 2 ||
+						state.touch.repeat_delay < 0 ||
+						state.touch.repeat_rate < 0) {
+					fprintf(stderr, "Bad autorepeat setting %s\n",
+							optarg);
+					return 1;
+				}
+				break;
+			case 'd':
+				// Hide instead of exiting
+				state.daemon = 1;
+				break;
+			case 'p':
+				// Let each hand chord on its own
+				state.touch.per_hand = 1;
+				break;
+			case 's':
+				// Accept commands on a control socket
+				ctl_path = optarg;
+				break;
+			case 'x':
+				// Own every touch on the device
+				state.exclusive = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-d] [-p] [-r delay,rate] [-s socket] [-x] [device-id]\n",
+						argv[0]);
+				return 1;
+		}
+	}
 
 	// Initialize chorder
 	chorder_init(&state.chorder, (const struct chord_entry *) map,
 			3, 64, handle_press, &state);
+	// Letters either autorepeat or type capitals when held, not both
+	if (set_long_variants(&state.chorder, MAP_SYMBOLS,
+				!state.touch.repeat_rate))
+		fprintf(stderr, "Failed to set up long-press variants\n");
+
+	// Bring back the macros recorded in earlier sessions
+	char *macro_path = config_path("macros");
+	if (chorder_init_macros(&state.chorder, CHORDER_ARENA_SIZE) ||
+			(macro_path &&
+			 chorder_load_macros(&state.chorder, macro_path)))
+		fprintf(stderr, "Failed to load macros\n");
 
 	// Open display
 	state.dpy = XOpenDisplay(NULL);
@@ -517,6 +1321,11 @@ int main(int argc, char **argv)
 		fprintf(stderr, "Could not open display\n");
 		goto out_destroy_chorder;
 	}
+	state.conn = XGetXCBConnection(state.dpy);
+	inject_init(&state.inject, state.dpy, state.conn);
+
+	// Fetch the keyboard mapping now rather than on the first chord
+	inject_keycode(&state.inject, XK_space);
 
 	// Ensure we have XInput...
 	int event, error;
@@ -545,10 +1354,17 @@ int main(int argc, char **argv)
 
 	// Get a specific device if given, otherwise find anything capable of
 	// direct-style touch input
-	int id = (argc > 1) ? atoi(argv[1]) : XIAllDevices;
-	ret = init_touch_device(&state, id);
+	int id = (optind < argc) ? atoi(argv[optind]) : XIAllDevices;
+	int ntouches;
+	ret = init_touch_device(&state, id, &ntouches);
 	if (ret)
 		goto out_close;
+	ret = touch_init(&state.touch, ntouches, &state.chorder, &touch_ops,
+			&state);
+	if (ret) {
+		fprintf(stderr, "Failed to allocate touches/IDs\n");
+		goto out_close;
+	}
 
 	// Get visual and colormap for transparent windows
 	ret = !XMatchVisualInfo(state.dpy, DefaultScreen(state.dpy),
@@ -562,32 +1378,122 @@ int main(int argc, char **argv)
 			state.xvi.visual, AllocNone);
 
 	// Create main window and keyboard buttons
-	ret = create_window(&state, default_btns,
-			sizeof(default_btns) / sizeof(default_btns[0]));
+	ret = create_window(&state, default_btns, num_default_btns);
 	if (ret) {
 		fprintf(stderr, "Failed to create windows\n");
 		goto out_free_cmap;
 	}
 
+	// Follow rotation and resolution changes if the server reports them
+	if (XRRQueryExtension(state.dpy, &state.randr_event, &error))
+		XRRSelectInput(state.dpy, DefaultRootWindow(state.dpy),
+				RRScreenChangeNotifyMask);
+	else
+		state.randr_event = 0;
+
+	// Start calibration from the user's saved offsets, if any
+	ret = calib_init(&state.calib, state.btns, state.nbtns);
+	if (ret)
+		goto out_destroy_window;
+	char *calib_path = config_path("calibration");
+	if (calib_path && calib_load(&state.calib, calib_path))
+		fprintf(stderr, "Failed to load calibration\n");
+
+	// Keep usage statistics, written out now and then
+	ret = stats_init(&state.stats);
+	if (ret)
+		goto out_destroy_calib;
+	state.stats_path = config_path("stats");
+	if (state.stats_path && !chorder_init_counts(&state.chorder))
+		state.stats_next = now_us() + STATS_SNAPSHOT_MS * 1e3;
+
+	// Keep the recent past for when something goes wrong
+	state.flight_path = config_path("flight");
+
+	// Publish counters for monitoring agents
+	if (metrics_open(&state.metrics))
+		fprintf(stderr, "Failed to publish metrics\n");
+
 	// Create a GC to use
-	state.gc = XCreateGC(state.dpy, state.win, 0, NULL);
+	state.gc = xcb_generate_id(state.conn);
+	xcb_create_gc(state.conn, state.gc, state.win, 0, NULL);
+
+	// Labels are a nicety, so carry on without them
+	if (create_labels(&state))
+		fprintf(stderr, "Failed to create button labels\n");
+
+	// Set up the handle for bringing back a hidden keyboard
+	if (state.daemon && create_handle(&state)) {
+		ret = 1;
+		fprintf(stderr, "Failed to create handle window\n");
+		goto out_free_gc;
+	}
+
+	int sigfds[2];
+	ret = init_signals(sigfds);
+	if (ret)
+		goto out_destroy_handle;
+
+	if (ctl_path && ctl_open(&state.ctl, ctl_path)) {
+		ret = 1;
+		fprintf(stderr, "Failed to open control socket\n");
+		goto out_close_signals;
+	}
 
 	// Display the window
 	map_window(&state);
-	update_display(&state);
-
-	ret = event_loop(&state);
+	invalidate_display(&state);
+	fprintf(stderr, "cold start: %.1f ms\n", (now_us() - start) / 1e3);
+
+	ret = event_loop(&state, sigfds[0]);
+
+	ctl_close(&state.ctl);
+out_close_signals:
+	close(sigfds[0]);
+	close(sigfds[1]);
+
+	// Report how long it took to decide who owns each touch
+	latency_report("touch accept", &state.accept_latency);
+	latency_report("touch reject", &state.reject_latency);
+	latency_report("show", &state.show_latency);
+	if (state.chord_requests.count)
+		fprintf(stderr, "requests per chord: mean %.1f, max %.0f\n",
+				state.chord_requests.total /
+				state.chord_requests.count,
+				state.chord_requests.max);
 
 	// Clean everything up
-	XFreeGC(state.dpy, state.gc);
+out_destroy_handle:
+	if (state.handle)
+		XDestroyWindow(state.dpy, state.handle);
+out_free_gc:
+	destroy_labels(&state);
+	xcb_free_gc(state.conn, state.gc);
+	if (state.stats_next)
+		stats_save(&state.stats, &state.chorder, state.stats_path);
+	free(state.stats_path);
+	stats_destroy(&state.stats);
+	if (state.flight_path)
+		flight_dump(&state.flight, state.flight_path);
+	free(state.flight_path);
+	metrics_close(&state.metrics);
+out_destroy_calib:
+	if (calib_path)
+		calib_save(&state.calib, calib_path);
+	free(calib_path);
+	calib_destroy(&state.calib);
+out_destroy_window:
 	destroy_window(&state);
 out_free_cmap:
 	XFreeColormap(state.dpy, state.cmap);
 out_destroy_touch:
-	destroy_touch_device(&state);
+	touch_destroy(&state.touch);
 out_close:
 	XCloseDisplay(state.dpy);
 out_destroy_chorder:
+	if (macro_path && state.chorder.arena)
+		chorder_save_macros(&state.chorder, macro_path);
+	free(macro_path);
 	chorder_destroy(&state.chorder);
 
 	return ret;
@@ -4,8 +4,15 @@
 #include <inttypes.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <xcb/xcb.h>
 
+#include "calib.h"
 #include "chorder.h"
+#include "ctl.h"
+#include "flight.h"
+#include "inject.h"
+#include "metrics.h"
+#include "stats.h"
 
 #define GRID_X 130
 #define GRID_Y 70
@@ -17,10 +24,49 @@
 #define CX 0
 #define CY 700
 
+// Number of button boundaries a finger must cross along a ring to swipe
+#define SWIPE_STEPS 2
+// Keys sent by sweeping a ring toward the screen center or back out
+#define SWIPE_FORWARD_SYM XK_space
+#define SWIPE_BACKWARD_SYM XK_BackSpace
+
+// Default autorepeat delay (ms) and rate (Hz); a rate of 0 disables it
+#define REPEAT_DELAY 500
+#define REPEAT_RATE 25
+// Most repeats sent at once when catching up
+#define REPEAT_MAX_BURST 16
+// Most one-shot mods carried over from a chord to its repeats
+#define REPEAT_MAX_MODS 8
+
+// Longest gap (ms) between the hands landing for them to form one chord in
+// per-hand mode
+#define HAND_SYNC_MS 40
+
+// Holding the chord for this key starts or stops recording a macro
+#define RECORD_SYM XK_Escape
+
+// Most flight recorder snapshots (on errors or SIGUSR2) written per run, so a
+// recurring error can't fill the disk
+#define FLIGHT_MAX_SNAPSHOTS 16
+
+// Display refresh rate (Hz) which redraws are paced to
+#define FRAME_RATE 60
+
+// Size of the corner handle which shows a hidden keyboard in daemon mode
+#define HANDLE_SIZE 32
+
+// Font and cell size (pixels) of the button labels
+#define LABEL_FONT "fixed"
+#define LABEL_W 64
+#define LABEL_H 20
+// Longest label drawn
+#define LABEL_LEN 6
+
 #define TRANSPARENT 0
 #define PRESSED_COLOR 0xd0888a85
 #define UNPRESSED_COLOR 0xd0204a87
 #define BORDER_COLOR 0xffeeeeec
+#define LABEL_COLOR 0xffeeeeec
 
 /*
  * Button geometry and info
@@ -30,7 +76,126 @@ struct layout_btn {
 	// In 1/64ths of degrees (i.e. # degrees * 64)
 	int th, dth;
 	int cx, cy;
-	uint8_t bits;
+	uint32_t bits;
+	// Effective hit region, which calibration may shift away from the
+	// drawn arc
+	int hr1, hr2;
+	int hth, hdth;
+	// Precomputed hit test data: squared radii and unit vectors along the
+	// starting and ending edges of the hit region
+	double hr1sq, hr2sq;
+	double ux1, uy1, ux2, uy2;
+};
+
+/*
+ * Position where a touch began
+ */
+struct touch_point {
+	double x, y;
+	// Hand whose button the touch is on (0 left, 1 right, -1 neither)
+	int hand;
+};
+
+/*
+ * Chord being formed by one hand in per-hand mode
+ */
+struct hand_chord {
+	// When the chord's first button was touched
+	double start;
+	unsigned int active : 1;
+};
+
+/*
+ * Progress of a finger sweeping along a ring of buttons
+ */
+struct swipe {
+	// Direction of travel (1 toward the screen center, -1 away, 0 none)
+	int dir;
+	// Consecutive boundaries crossed in that direction
+	int steps;
+	// Whether this touch has already produced a gesture
+	unsigned int fired : 1;
+};
+
+/*
+ * Why a touch tracker commits a chord
+ */
+enum touch_commit {
+	// A touch was lifted
+	TOUCH_RELEASED,
+	// The chord was held past the autorepeat delay
+	TOUCH_REPEATED,
+	// The chord was held past its long-press threshold, so its long
+	// variant is wanted
+	TOUCH_HELD,
+};
+
+/*
+ * What a touch tracker does with the chords and keys it recognizes
+ */
+struct touch_ops {
+	// Commits the chord formed by the given bits of the touches still
+	// held
+	int (*commit)(void *arg, uint32_t bits, unsigned long time,
+			enum touch_commit how);
+	// Types the key for a swipe, which takes the place of the chord
+	int (*swipe)(void *arg, KeySym sym);
+	// Types one more repeat of an autorepeating key, with the tracker's
+	// repeat_mods held around it
+	void (*repeat)(void *arg, KeySym sym);
+};
+
+/*
+ * Touches held on the keyboard and the chords they form.  This knows nothing
+ * of where touches come from, so the simulator drives the same code as the
+ * real keyboard.  Times are in microseconds.
+ */
+struct touch_tracker {
+	const struct touch_ops *ops;
+	void *arg;
+	// Keymap which decides what holding a chord does
+	struct chorder *chorder;
+	// Buttons touches are tested against, and the number of chord bits
+	// belonging to each hand
+	struct layout_btn *btns;
+	int nbtns;
+	int hand_bits;
+	// Slot for each touch held, with its button (NULL if it is off the
+	// keyboard), XInput touch ID (0 if the slot is free), starting point
+	// and swipe progress
+	int ntouches;
+	struct layout_btn **touches;
+	int *touchids;
+	struct touch_point *touchpts;
+	struct swipe *swipes;
+	// Autorepeat settings, the key being repeated and when the next repeat
+	// (or, before the first, the end of the chord's hold) is due
+	int repeat_delay;
+	int repeat_rate;
+	KeySym repeat_sym;
+	double repeat_next;
+	// One-shot mods which applied to the key being repeated, outermost
+	// first; the chord released them, so each repeat presses them again
+	unsigned long repeat_mods[REPEAT_MAX_MODS];
+	int repeat_nmods;
+	// Chords being formed by each hand in per-hand mode, and the hand
+	// whose chord is being timed for a hold
+	struct hand_chord hands[2];
+	int hold_hand;
+	// Whether a chord will commit on the next release
+	unsigned int active : 1;
+	// Whether each hand commits its own chords independently
+	unsigned int per_hand : 1;
+	// Whether both hands landed together and form one chord
+	unsigned int merged : 1;
+};
+
+/*
+ * Running statistics for a latency measurement, in microseconds
+ */
+struct latency {
+	unsigned long count;
+	double total, max;
 };
 
 /*
@@ -41,41 +206,121 @@ struct kbd_state {
 	XVisualInfo xvi;
 	Colormap cmap;
 	Window win;
-	GC gc;
+	// Input-only window which brings the keyboard back (daemon mode)
+	Window handle;
+	// XCB connection underneath dpy, which the touch, injection and
+	// drawing paths use so that they never wait on the server, and the
+	// sequence number of the last request they sent
+	xcb_connection_t *conn;
+	unsigned int seq;
+	xcb_gcontext_t gc;
+	// Stencils of every button's label in every map, one LABEL_W by
+	// LABEL_H cell per button in a row per map, and a GC which paints
+	// through them
+	Pixmap labels;
+	xcb_gcontext_t label_gc;
+	// Synthetic key events sent for chords
+	struct inject inject;
 	int xi_opcode;
+	// First RandR event code (0 if the server has no RandR)
+	int randr_event;
 	int input_dev;
+	// Layout the buttons were placed from, and the screen size they were
+	// placed for
+	const struct layout *layout;
+	int swidth, sheight;
 	int nbtns;
-	int ntouches;
+	// Number of chord bits belonging to each hand
+	int hand_bits;
 	struct layout_btn *btns;
-	struct layout_btn **touches;
-	int *touchids;
+	struct touch_tracker touch;
 	struct chorder chorder;
-	unsigned int active : 1;
+	struct calib calib;
+	struct stats stats;
+	// Counters published for monitors
+	struct metrics metrics;
+	// Control socket for scripted input
+	struct ctl ctl;
+	// Where statistics are written (NULL to keep none), and when next
+	char *stats_path;
+	double stats_next;
+	// Recent events, and where they are dumped at exit (NULL for nowhere);
+	// snapshots taken while running go beside it under their own names
+	struct flight flight;
+	char *flight_path;
+	// Snapshots of the flight recorder written so far
+	int flight_snapshots;
+	// Time taken to accept or reject a new touch
+	struct latency accept_latency;
+	struct latency reject_latency;
+	// Time from a request to show the keyboard until it is mapped
+	double show_start;
+	struct latency show_latency;
+	// Requests sent to the server for each chord
+	struct latency chord_requests;
+	// When the event which committed the chord waiting to be flushed
+	// arrived, and the last request sent before the chord began
+	double chord_us;
+	unsigned int chord_seq;
+	// Server time of the last XInput event and when we received it
+	Time last_time;
+	double last_us;
+	// When the pending redraw is due (0 if the display is up to date) and
+	// when the last one was drawn
+	double redraw_next;
+	double last_frame;
+	// Chord bits and map the buttons were last drawn for
+	uint32_t shown_bits;
+	unsigned long shown_map;
 	unsigned int shutdown : 1;
+	// Whether a chord has been committed since the last flush
+	unsigned int chord_pending : 1;
+	// Whether we grab every touch rather than just those on the keyboard
+	unsigned int exclusive : 1;
+	// Whether to stay resident and hide rather than exit
+	unsigned int daemon : 1;
+	unsigned int hidden : 1;
+	// Whether every button must be drawn on the next redraw
+	unsigned int redraw_all : 1;
 };
 
 
 /*
- * Represents one button in a given layout
+ * Represents one button in a given layout.  The bits are for the left hand;
+ * the right hand's bank is mirrored into the bits above them, so each hand
+ * may use up to 16 bits.
  */
 struct layout {
 	uint8_t row;
 	uint8_t th, dth;
-	uint8_t bits;
+	uint16_t bits;
 };
 
-/*
- * Default button layout
- */
-static const struct layout default_btns[] = {
-	{1, 0, 1, 4},
-	{1, 1, 1, 6},
-	{1, 2, 1, 2},
-	{1, 3, 1, 3},
-	{1, 4, 1, 1},
-
-	{0, 0, 3, 7},
-	{0, 3, 2, 5},
-};
+extern const struct layout default_btns[];
+extern const int num_default_btns;
+
+int layout_place(struct layout_btn *btns, const struct layout *lt,
+		int num_btns, int swidth);
+void layout_set_hit(struct layout_btn *btn, int r1, int r2, int th, int dth);
+int layout_hit(const struct layout_btn *btn, double x, double y);
+
+int set_long_variants(struct chorder *kbd, unsigned long undo_map,
+		int capitals_on);
+int touch_init(struct touch_tracker *t, int ntouches, struct chorder *kbd,
+		const struct touch_ops *ops, void *arg);
+void touch_destroy(struct touch_tracker *t);
+void touch_set_layout(struct touch_tracker *t, struct layout_btn *btns,
+		int nbtns, int hand_bits);
+void touch_clear(struct touch_tracker *t);
+struct layout_btn *touch_hit(struct touch_tracker *t, double x, double y);
+uint32_t touch_pressed_bits(const struct touch_tracker *t);
+int touch_begin(struct touch_tracker *t, struct layout_btn *btn, int touchid,
+		double x, double y, double now);
+int touch_index(const struct touch_tracker *t, int touchid);
+int touch_dismissed(const struct touch_tracker *t);
+int touch_move(struct touch_tracker *t, int idx, double x, double y,
+		double now);
+int touch_end(struct touch_tracker *t, int idx, unsigned long time);
+int touch_run_hold(struct touch_tracker *t, double now, unsigned long time);
 
 #endif
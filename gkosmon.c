@@ -0,0 +1,63 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+#include "metrics.h"
+
+/*
+ * Prints the counters gkos publishes in shared memory, once or every given
+ * number of milliseconds
+ */
+
+/*
+ * Prints a list of mods by keysym name
+ */
+static void print_mods(const char *label, const uint64_t *codes, uint32_t n)
+{
+	uint32_t i;
+	printf("%s", label);
+	for (i = 0; i < n && i < METRICS_MAX_MODS; i++) {
+		const char *name = XKeysymToString(codes[i]);
+		printf(" %s", name ? name : "?");
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%s%u", METRICS_NAME,
+			(unsigned int) getuid());
+
+	long interval = argc > 1 ? atol(argv[1]) : 0;
+	const struct metrics_page *page = metrics_attach(name);
+	if (!page)
+		return 1;
+
+	do {
+		struct metrics_page m;
+		metrics_read(page, &m);
+
+		printf("chords %lu touches %lu misfires %lu\n",
+				(unsigned long) m.chords,
+				(unsigned long) m.touches,
+				(unsigned long) m.misfires);
+		printf("map %u%s\n", m.current_map, m.maplock ? " locked" : "");
+		print_mods("mods", m.mods, m.nmods);
+		print_mods("locks", m.locks, m.nlocks);
+		printf("latency");
+		int i;
+		for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+			printf(" %lu", (unsigned long) m.latency[i]);
+		printf("\n");
+		fflush(stdout);
+
+		if (interval)
+			usleep(interval * 1000);
+	} while (interval);
+
+	return 0;
+}
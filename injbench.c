@@ -0,0 +1,359 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/keysym.h>
+#include <xcb/xtest.h>
+
+#include "chorder.h"
+#include "gkos.h"
+#include "inject.h"
+
+/*
+ * Measures how long typed chords take to reach a client.  Chords are tapped
+ * out as touches on the same touch tracker as gkos, which commits them to a
+ * chorder whose output goes through the same XTest injection, and a sink
+ * window on a second connection, holding the input focus, notes when the
+ * last key event of each chord arrives.  Meant to be run on a private Xvfb
+ * (see "make bench") so nothing else competes for the server.
+ */
+
+// Chords timed per scenario, after the warm-up
+#define DEF_SAMPLES 1000
+#define WARMUP 20
+// Longest wait (ms) for a chord's key events before giving up
+#define SINK_TIMEOUT_MS 2000
+
+// Long macro: a short sentence
+static struct chord_entry sentence[] = {
+	{.type = TYPE_KEY, .arg.code = 't'},
+	{.type = TYPE_KEY, .arg.code = 'h'},
+	{.type = TYPE_KEY, .arg.code = 'e'},
+	{.type = TYPE_KEY, .arg.code = XK_space},
+	{.type = TYPE_KEY, .arg.code = 'q'},
+	{.type = TYPE_KEY, .arg.code = 'u'},
+	{.type = TYPE_KEY, .arg.code = 'i'},
+	{.type = TYPE_KEY, .arg.code = 'c'},
+	{.type = TYPE_KEY, .arg.code = 'k'},
+	{.type = TYPE_KEY, .arg.code = XK_space},
+	{.type = TYPE_MOD, .arg.code = XK_Shift_L},
+	{.type = TYPE_KEY, .arg.code = 'f'},
+	{.type = TYPE_KEY, .arg.code = 'o'},
+	{.type = TYPE_KEY, .arg.code = 'x'},
+	{.type = TYPE_KEY, .arg.code = XK_period},
+	{.type = TYPE_KEY, .arg.code = XK_Return},
+	{.type = TYPE_NONE},
+};
+
+/*
+ * Stub touch source: one button per chord bit, all on the left hand.  Only
+ * their bits matter, as touches land on them directly rather than being hit
+ * tested.
+ */
+static struct layout_btn btns[] = {
+	{.bits = 1},
+	{.bits = 2},
+};
+#define HAND_BITS 2
+
+static struct chord_binding bindings[] = {
+	{.code = 1, .entry = {.type = TYPE_KEY, .arg.code = 'a'}},
+	{.code = 2, .entry = {.type = TYPE_MOD, .arg.code = XK_Control_L}},
+	{.code = 3, .entry = {.type = TYPE_MACRO, .arg.ptr = sentence}},
+};
+
+/*
+ * Chords making up each measured case
+ */
+struct scenario {
+	const char *name;
+	uint32_t codes[2];
+	int ncodes;
+};
+
+static const struct scenario scenarios[] = {
+	{"single key", {1}, 1},
+	{"mod + key", {2, 1}, 2},
+	{"macro", {3}, 1},
+};
+
+/*
+ * Injection state, counting the key events sent
+ */
+struct bench {
+	struct inject inject;
+	unsigned long sent;
+};
+
+/*
+ * Sink window and the key events it has seen
+ */
+struct sink {
+	Display *dpy;
+	Window win;
+	unsigned long received;
+	Time first, last;
+};
+
+/*
+ * Returns a monotonic timestamp in microseconds
+ */
+static double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Keypress implementation to pass to the chorder
+ */
+static void bench_press(void *arg, unsigned long sym, int press)
+{
+	struct bench *b = arg;
+	inject_key(&b->inject, sym, press);
+	b->sent++;
+}
+
+/*
+ * Touch tracker callback, passing a committed chord on to the chorder
+ */
+static int bench_commit(void *arg, uint32_t bits, unsigned long time,
+		enum touch_commit how)
+{
+	(void) time;
+	(void) how;
+	return chorder_press(arg, bits);
+}
+
+/*
+ * Touch tracker callback for swipes, which the stub touches never make
+ */
+static int bench_swipe(void *arg, KeySym sym)
+{
+	(void) arg;
+	(void) sym;
+	return 0;
+}
+
+/*
+ * Touch tracker callback for autorepeat, which is turned off
+ */
+static void bench_repeat(void *arg, KeySym sym)
+{
+	(void) arg;
+	(void) sym;
+}
+
+static const struct touch_ops bench_ops = {
+	.commit = bench_commit,
+	.swipe = bench_swipe,
+	.repeat = bench_repeat,
+};
+
+/*
+ * Taps a chord: a touch lands on each of its buttons, then all lift, the
+ * first release committing the chord
+ */
+static int tap_chord(struct touch_tracker *t, uint32_t code)
+{
+	double now = now_us();
+	int i, n = sizeof(btns) / sizeof(btns[0]);
+
+	for (i = 0; i < n; i++)
+		if ((btns[i].bits & code) &&
+				touch_begin(t, &btns[i], i + 1, 0, 0, now))
+			return 1;
+	for (i = 0; i < n; i++) {
+		int idx = touch_index(t, i + 1);
+		if (idx >= 0 && touch_end(t, idx, 0))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Creates the sink window and gives it the input focus
+ */
+static int sink_open(struct sink *s)
+{
+	s->dpy = XOpenDisplay(NULL);
+	if (!s->dpy) {
+		fprintf(stderr, "Could not open sink display\n");
+		return 1;
+	}
+	s->win = XCreateSimpleWindow(s->dpy, DefaultRootWindow(s->dpy), 0, 0,
+			100, 100, 0, 0, 0);
+	XSelectInput(s->dpy, s->win, KeyPressMask | KeyReleaseMask |
+			StructureNotifyMask);
+	XMapWindow(s->dpy, s->win);
+
+	XEvent ev;
+	do
+		XNextEvent(s->dpy, &ev);
+	while (ev.type != MapNotify);
+	XSetInputFocus(s->dpy, s->win, RevertToParent, CurrentTime);
+	XSync(s->dpy, False);
+	return 0;
+}
+
+/*
+ * Waits until the sink has seen the given number of key events, returning
+ * the time the last one arrived, or 0 on timeout
+ */
+static double sink_wait(struct sink *s, unsigned long count)
+{
+	double t = 0;
+	while (s->received < count) {
+		if (!XPending(s->dpy)) {
+			struct pollfd pfd = {ConnectionNumber(s->dpy), POLLIN, 0};
+			if (poll(&pfd, 1, SINK_TIMEOUT_MS) <= 0)
+				return 0;
+		}
+
+		XEvent ev;
+		XNextEvent(s->dpy, &ev);
+		if (ev.type != KeyPress && ev.type != KeyRelease)
+			continue;
+		t = now_us();
+		if (!s->received++)
+			s->first = ev.xkey.time;
+		s->last = ev.xkey.time;
+	}
+	return t;
+}
+
+/*
+ * Orders samples for taking percentiles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+	return (da > db) - (da < db);
+}
+
+/*
+ * Times one scenario, printing its latency distribution
+ */
+static int run_scenario(struct bench *b, struct sink *s,
+		struct touch_tracker *t, const struct scenario *sc,
+		double *samples, int nsamples)
+{
+	unsigned long events = 0;
+	double busy = 0;
+	int i, j;
+
+	for (i = -WARMUP; i < nsamples; i++) {
+		unsigned long start = b->sent;
+		double t0 = now_us();
+		for (j = 0; j < sc->ncodes; j++)
+			if (tap_chord(t, sc->codes[j]))
+				return 1;
+		xcb_flush(b->inject.conn);
+
+		double t1 = sink_wait(s, b->sent);
+		if (!t1) {
+			fprintf(stderr, "%s: key events lost\n", sc->name);
+			return 1;
+		}
+		if (i < 0)
+			continue;
+		samples[i] = t1 - t0;
+		busy += t1 - t0;
+		events += b->sent - start;
+	}
+
+	qsort(samples, nsamples, sizeof(samples[0]), cmp_double);
+	printf("%-12s %6lu %8.1f %8.1f %8.1f %8.1f %10.0f\n", sc->name,
+			events / nsamples, samples[nsamples / 2],
+			samples[nsamples * 9 / 10], samples[nsamples * 99 / 100],
+			samples[nsamples - 1], events / busy * 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int nsamples = DEF_SAMPLES;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n':
+				nsamples = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n samples]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (nsamples < 1)
+		nsamples = 1;
+
+	struct bench b = {.sent = 0};
+	struct sink s = {.received = 0};
+	struct chorder kbd;
+	struct touch_tracker t = {.repeat_rate = 0};
+	int ret = 1;
+
+	Display *dpy = XOpenDisplay(NULL);
+	if (!dpy) {
+		fprintf(stderr, "Could not open display\n");
+		return 1;
+	}
+	xcb_connection_t *conn = XGetXCBConnection(dpy);
+	const xcb_query_extension_reply_t *ext =
+		xcb_get_extension_data(conn, &xcb_test_id);
+	if (!ext || !ext->present) {
+		fprintf(stderr, "XTest extension not available\n");
+		goto out_close_display;
+	}
+	inject_init(&b.inject, dpy, conn);
+
+	if (sink_open(&s))
+		goto out_close_display;
+
+	double *samples = malloc(nsamples * sizeof(samples[0]));
+	if (!samples) {
+		perror("malloc");
+		goto out_close_sink;
+	}
+
+	if (chorder_init_sparse(&kbd, bindings,
+				sizeof(bindings) / sizeof(bindings[0]), 1, 2,
+				bench_press, &b))
+		goto out_free_samples;
+	if (touch_init(&t, sizeof(btns) / sizeof(btns[0]), &kbd, &bench_ops,
+				&kbd))
+		goto out_destroy_chorder;
+	touch_set_layout(&t, btns, sizeof(btns) / sizeof(btns[0]), HAND_BITS);
+
+	printf("%-12s %6s %8s %8s %8s %8s %10s\n", "chord", "keys", "p50 us",
+			"p90 us", "p99 us", "max us", "keys/s");
+	size_t i;
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+		if (run_scenario(&b, &s, &t, &scenarios[i], samples,
+					nsamples))
+			goto out_destroy_touch;
+	printf("server time for %lu key events: %lu ms\n", s.received,
+			(unsigned long) (s.last - s.first));
+	ret = 0;
+
+out_destroy_touch:
+	touch_destroy(&t);
+out_destroy_chorder:
+	chorder_destroy(&kbd);
+	xcb_flush(conn);
+out_free_samples:
+	free(samples);
+out_close_sink:
+	XCloseDisplay(s.dpy);
+out_close_display:
+	XCloseDisplay(dpy);
+	return ret;
+}
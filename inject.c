@@ -0,0 +1,54 @@
+#include <string.h>
+#include <xcb/xtest.h>
+
+#include "inject.h"
+
+/*
+ * Sets up key injection on a display and its XCB connection
+ */
+void inject_init(struct inject *inj, Display *dpy, xcb_connection_t *conn)
+{
+	inj->dpy = dpy;
+	inj->conn = conn;
+	inject_forget_keycodes(inj);
+}
+
+/*
+ * Drops the cached keycodes, for when the keyboard mapping changes
+ */
+void inject_forget_keycodes(struct inject *inj)
+{
+	memset(inj->keycodes, 0, sizeof(inj->keycodes));
+}
+
+/*
+ * Finds the keycode which types a keysym.  Latin-1 and function keys, which
+ * are nearly everything we type, are cached so the usual case is a table
+ * lookup.
+ */
+KeyCode inject_keycode(struct inject *inj, KeySym sym)
+{
+	KeyCode *slot = NULL;
+	if (sym <= 0xff)
+		slot = &inj->keycodes[0][sym];
+	else if ((sym & ~0xffUL) == 0xff00)
+		slot = &inj->keycodes[1][sym & 0xff];
+	if (slot && *slot)
+		return *slot;
+
+	KeyCode code = XKeysymToKeycode(inj->dpy, sym);
+	if (slot)
+		*slot = code;
+	return code;
+}
+
+/*
+ * Queues a key press or release, returning the request's sequence number
+ */
+unsigned int inject_key(struct inject *inj, KeySym sym, int press)
+{
+	return xcb_test_fake_input(inj->conn,
+			press ? XCB_KEY_PRESS : XCB_KEY_RELEASE,
+			inject_keycode(inj, sym), XCB_CURRENT_TIME, XCB_NONE,
+			0, 0, 0).sequence;
+}
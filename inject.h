@@ -0,0 +1,25 @@
+#ifndef INJECT_H_
+#define INJECT_H_
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+/*
+ * Sends synthetic key events through XTest.  Requests are only queued; the
+ * caller flushes the connection once per batch.
+ */
+struct inject {
+	Display *dpy;
+	xcb_connection_t *conn;
+	// Keycodes of the Latin-1 and function keysyms, filled in as they are
+	// first typed (0 if not known yet)
+	KeyCode keycodes[2][256];
+};
+
+void inject_init(struct inject *inj, Display *dpy, xcb_connection_t *conn);
+void inject_forget_keycodes(struct inject *inj);
+
+KeyCode inject_keycode(struct inject *inj, KeySym sym);
+unsigned int inject_key(struct inject *inj, KeySym sym, int press);
+
+#endif
@@ -0,0 +1,97 @@
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+
+#include "gkos.h"
+
+/*
+ * Default button layout
+ */
+const struct layout default_btns[] = {
+	{1, 0, 1, 4},
+	{1, 1, 1, 6},
+	{1, 2, 1, 2},
+	{1, 3, 1, 3},
+	{1, 4, 1, 1},
+
+	{0, 0, 3, 7},
+	{0, 3, 2, 5},
+};
+
+const int num_default_btns = sizeof(default_btns) / sizeof(default_btns[0]);
+
+/*
+ * Places a layout's buttons on a screen of the given width: the layout as
+ * given in the left corner, and mirrored in the right with its bits just
+ * above the left hand's.  btns must have room for twice num_btns.  Returns
+ * the number of chord bits belonging to each hand.
+ */
+int layout_place(struct layout_btn *btns, const struct layout *lt,
+		int num_btns, int swidth)
+{
+	int i, hand_bits;
+
+	// Find how many bits one hand's chords take up, so the right bank can
+	// be mirrored just above the left
+	uint16_t allbits = 0;
+	for (i = 0; i < num_btns; i++)
+		allbits |= lt[i].bits;
+	for (hand_bits = 0; allbits >> hand_bits; hand_bits++)
+		;
+
+	for (i = 0; i < num_btns; i++) {
+		// Index of mirrored key
+		int m = i + num_btns;
+
+		btns[i].r1 = btns[m].r1 = IR + lt[i].row * DR;
+		btns[i].r2 = btns[m].r2 = btns[i].r1 + DR;
+		btns[i].th = 5760 - (lt[i].th + lt[i].dth) * DTH;
+		btns[m].th = 5760 + lt[i].th * DTH;
+		btns[i].dth = btns[m].dth = lt[i].dth * DTH;
+		btns[i].cx = CX;
+		btns[m].cx = swidth - 1 - CX;
+		btns[i].cy = btns[m].cy = CY;
+		btns[i].bits = lt[i].bits;
+		btns[m].bits = (uint32_t) lt[i].bits << hand_bits;
+	}
+	for (i = 0; i < 2 * num_btns; i++)
+		layout_set_hit(&btns[i], btns[i].r1, btns[i].r2, btns[i].th,
+				btns[i].dth);
+	return hand_bits;
+}
+
+/*
+ * Sets a button's hit region and precomputes the data used to test points
+ * against it, so hit testing needs no trigonometry
+ */
+void layout_set_hit(struct layout_btn *btn, int r1, int r2, int th, int dth)
+{
+	btn->hr1 = r1;
+	btn->hr2 = r2;
+	btn->hth = th;
+	btn->hdth = dth;
+
+	btn->hr1sq = (double) r1 * r1;
+	btn->hr2sq = (double) r2 * r2;
+	btn->ux1 = cos(M_PI * th / 11520.0);
+	btn->uy1 = sin(M_PI * th / 11520.0);
+	btn->ux2 = cos(M_PI * (th + dth) / 11520.0);
+	btn->uy2 = sin(M_PI * (th + dth) / 11520.0);
+}
+
+/*
+ * Returns nonzero if the given point lies within a button's hit region.  Only
+ * valid for sectors narrower than 180 degrees.
+ */
+int layout_hit(const struct layout_btn *btn, double x, double y)
+{
+	double dx = x - btn->cx;
+	double dy = btn->cy - y;
+	double rsq = dx * dx + dy * dy;
+	if (rsq < btn->hr1sq || rsq > btn->hr2sq)
+		return 0;
+
+	// Counterclockwise of the starting edge and clockwise of the ending one
+	return btn->ux1 * dy - btn->uy1 * dx >= 0 &&
+		dx * btn->uy2 - dy * btn->ux2 >= 0;
+}
@@ -0,0 +1,752 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "chorder.h"
+#include "corpus.h"
+#include "english_optimized.h"
+#include "gkos.h"
+#include "revindex.h"
+
+/*
+ * Searches for chord assignments which make a corpus cheap to type.  The
+ * symbols in the primary and punctuation slots of each map (as described in
+ * kbd.py) are permuted among those slots by simulated annealing, one
+ * independent chain per thread, scoring each chord with a finger cost model
+ * built from the arc geometry in gkos.h.  The other slots (editing keys, mods
+ * and map switches) are left where they are.
+ */
+
+// Chord codes whose assignments are optimized: kbd.py's primap, then puncmap
+static const uint32_t slots[] = {
+	1, 2, 4, 8, 16, 32,
+	3, 6, 24, 48,
+	5, 40,
+	11, 19, 35,
+	14, 22, 38,
+	25, 26, 28,
+	49, 50, 52,
+	13, 29, 21, 53, 37,
+	41, 43, 42, 46, 44,
+
+	17, 34, 12, 10, 20, 33, 30, 51,
+};
+#define NSLOTS (sizeof(slots) / sizeof(slots[0]))
+#define NPRIMARY 34
+
+// Maps in the keymap, with their names in kbd.py and english_optimized.h
+#define NMAPS 3
+static const char *const json_names[NMAPS] = {"lowercase", "numbers", "symbols"};
+static const char *const enum_names[NMAPS] = {
+	"MAP_DEFAULT", "MAP_NUMBERS", "MAP_SYMBOLS",
+};
+
+// Code points tracked for counting
+#define NCODEPOINTS 0x10000
+
+// Finger cost model, in units of one tap
+#define COST_TAP 1.0
+// Per ring width of distance from the thumb's resting point
+#define COST_REACH 0.5
+// For coordinating both hands in one chord
+#define COST_BOTH 0.3
+// Per ring width a thumb travels between consecutive chords
+#define COST_MOVE 0.4
+// For lifting and retapping the same button
+#define COST_REPEAT 0.2
+
+/*
+ * Symbols to be placed in one map, with their corpus statistics
+ */
+struct pool {
+	unsigned long syms[NSLOTS];
+	int n;
+	double freq[NSLOTS];
+	double bigram[NSLOTS][NSLOTS];
+};
+
+/*
+ * Counts gathered by one thread
+ */
+struct counts {
+	const uint16_t *lookup;
+	double freq[NMAPS][NSLOTS];
+	double bigram[NMAPS][NSLOTS][NSLOTS];
+	uint64_t *hist;
+};
+
+/*
+ * One annealing chain and the best assignment it found for each map
+ */
+struct chain {
+	uint64_t rng;
+	long iterations;
+	int best[NMAPS][NSLOTS];
+	double best_cost[NMAPS];
+};
+
+static struct pool pools[NMAPS];
+
+// Cost of each chord on its own, and of following one chord with another
+static double cost1[64];
+static double cost2[64][64];
+
+/*
+ * Converts a keysym to the code point it types, or 0 if it is not a character
+ */
+static unsigned long keysym_cp(unsigned long sym)
+{
+	if ((sym >= 0x20 && sym < 0x7f) || (sym >= 0xa0 && sym < 0x100))
+		return sym;
+	if ((sym & 0xff000000) == 0x01000000)
+		return sym & 0x00ffffff;
+	return 0;
+}
+
+/*
+ * Folds uppercase Latin letters onto lowercase, since both use one chord
+ */
+static unsigned long fold(unsigned long cp)
+{
+	if ((cp >= 'A' && cp <= 'Z') ||
+			(cp >= 0xc0 && cp <= 0xde && cp != 0xd7))
+		return cp + 0x20;
+	return cp;
+}
+
+/*
+ * Returns the position of the button pressed by one hand to make the given
+ * half of a chord, in the left bank's coordinates
+ */
+static int half_pos(unsigned int half, double *x, double *y)
+{
+	int i;
+	for (i = 0; i < num_default_btns; i++) {
+		const struct layout *lt = &default_btns[i];
+		if (lt->bits != half)
+			continue;
+		double r = IR + lt->row * DR + DR / 2.0;
+		double th = 5760 - (lt->th + lt->dth / 2.0) * DTH;
+		*x = r * cos(M_PI * th / 11520.0);
+		*y = r * sin(M_PI * th / 11520.0);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Builds the per-chord cost tables from the button geometry.  Chords which
+ * need a button the layout doesn't have get a prohibitive cost.
+ */
+static void build_costs(void)
+{
+	int hand_bits, i;
+	unsigned int allbits = 0;
+	for (i = 0; i < num_default_btns; i++)
+		allbits |= default_btns[i].bits;
+	for (hand_bits = 0; allbits >> hand_bits; hand_bits++)
+		;
+	unsigned int mask = (1U << hand_bits) - 1;
+
+	// The thumb rests at the middle of all the buttons
+	double rx = 0, ry = 0, x, y;
+	for (i = 0; i < num_default_btns; i++) {
+		half_pos(default_btns[i].bits, &x, &y);
+		rx += x / num_default_btns;
+		ry += y / num_default_btns;
+	}
+
+	unsigned int c, d;
+	for (c = 0; c < 64; c++) {
+		unsigned int h[2] = {c & mask, (c >> hand_bits) & mask};
+		double cost = (h[0] && h[1]) ? COST_BOTH : 0;
+		int k;
+		for (k = 0; k < 2; k++) {
+			if (!h[k])
+				continue;
+			if (half_pos(h[k], &x, &y)) {
+				cost = 1e9;
+				break;
+			}
+			cost += COST_TAP + COST_REACH *
+				hypot(x - rx, y - ry) / DR;
+		}
+		cost1[c] = cost;
+	}
+
+	for (c = 0; c < 64; c++) {
+		for (d = 0; d < 64; d++) {
+			double cost = 0;
+			int k;
+			for (k = 0; k < 2; k++) {
+				unsigned int a = (c >> (k * hand_bits)) & mask;
+				unsigned int b = (d >> (k * hand_bits)) & mask;
+				double ax, ay, bx, by;
+				if (!a || !b || half_pos(a, &ax, &ay) ||
+						half_pos(b, &bx, &by))
+					continue;
+				cost += (a == b) ? COST_REPEAT : COST_MOVE *
+					hypot(ax - bx, ay - by) / DR;
+			}
+			cost2[c][d] = cost;
+		}
+	}
+}
+
+/*
+ * Total cost of one map's assignment (slot index of each symbol)
+ */
+static double map_cost(const struct pool *p, const int *slot_of)
+{
+	double cost = 0;
+	int i, j;
+	for (i = 0; i < p->n; i++) {
+		cost += p->freq[i] * cost1[slots[slot_of[i]]];
+		for (j = 0; j < p->n; j++)
+			cost += p->bigram[i][j] *
+				cost2[slots[slot_of[i]]][slots[slot_of[j]]];
+	}
+	return cost;
+}
+
+/*
+ * Cost of all terms involving symbols a and b (either may be -1), used to
+ * evaluate a swap incrementally
+ */
+static double pair_cost(const struct pool *p, const int *slot_of, int a, int b)
+{
+	int s[2] = {a, b};
+	double cost = 0;
+	int k, j;
+	for (k = 0; k < 2; k++) {
+		int x = s[k];
+		if (x < 0 || (k == 1 && b == a))
+			continue;
+		uint32_t cx = slots[slot_of[x]];
+		cost += p->freq[x] * cost1[cx];
+		for (j = 0; j < p->n; j++) {
+			uint32_t cj = slots[slot_of[j]];
+			if (j == a || j == b) {
+				// Counted once, from the first of the pair
+				cost += p->bigram[x][j] * cost2[cx][cj];
+				continue;
+			}
+			cost += p->bigram[x][j] * cost2[cx][cj] +
+				p->bigram[j][x] * cost2[cj][cx];
+		}
+	}
+	return cost;
+}
+
+/*
+ * Small, fast random number generator (xorshift64*)
+ */
+static uint64_t next_rand(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Anneals one map, starting from the given assignment of slots to symbols
+ * (occ[slot] is a symbol index or -1).  Leaves the best found in best.
+ */
+static double anneal(const struct pool *p, const int *start, int *best,
+		long iterations, uint64_t *rng)
+{
+	int occ[NSLOTS], slot_of[NSLOTS];
+	unsigned int i;
+	memcpy(occ, start, sizeof(occ));
+	for (i = 0; i < NSLOTS; i++)
+		if (occ[i] >= 0)
+			slot_of[occ[i]] = i;
+
+	double cost = map_cost(p, slot_of), best_cost = cost;
+	memcpy(best, occ, sizeof(occ));
+	if (p->n < 1)
+		return cost;
+
+	// Start hot enough to accept typical uphill moves, and cool to a
+	// thousandth of that
+	double t0 = cost > 0 ? cost / p->n : 1, t1 = t0 / 1000, t = t0;
+	double cool = pow(t1 / t0, 1.0 / iterations);
+
+	long it;
+	for (it = 0; it < iterations; it++, t *= cool) {
+		int s1 = next_rand(rng) % NSLOTS, s2 = next_rand(rng) % NSLOTS;
+		int a = occ[s1], b = occ[s2];
+		if (s1 == s2 || (a < 0 && b < 0))
+			continue;
+
+		double before = pair_cost(p, slot_of, a, b);
+		if (a >= 0)
+			slot_of[a] = s2;
+		if (b >= 0)
+			slot_of[b] = s1;
+		double delta = pair_cost(p, slot_of, a, b) - before;
+
+		double u = (next_rand(rng) >> 11) * (1.0 / 9007199254740992.0);
+		if (delta <= 0 || u < exp(-delta / t)) {
+			occ[s1] = b;
+			occ[s2] = a;
+			cost += delta;
+			if (cost < best_cost - 1e-9) {
+				best_cost = cost;
+				memcpy(best, occ, sizeof(occ));
+			}
+		} else {
+			if (a >= 0)
+				slot_of[a] = s1;
+			if (b >= 0)
+				slot_of[b] = s2;
+		}
+	}
+	return best_cost;
+}
+
+/*
+ * Initial assignment: each map's symbols in the slots they occupy now
+ */
+static int start_occ[NMAPS][NSLOTS];
+
+/*
+ * Thread body running one annealing chain over every map
+ */
+static void *run_chain(void *arg)
+{
+	struct chain *c = arg;
+	int m;
+	for (m = 0; m < NMAPS; m++)
+		c->best_cost[m] = anneal(&pools[m], start_occ[m], c->best[m],
+				c->iterations, &c->rng);
+	return NULL;
+}
+
+/*
+ * Counts symbol frequencies and bigrams within each map in one piece of the
+ * corpus.  Characters outside every pool break bigram runs.
+ */
+static void count_chunk(void *arg, const unsigned char *buf, size_t len,
+		int last)
+{
+	struct counts *c = arg;
+	const unsigned char *p = buf, *end = buf + len;
+	int prev = 0;
+	while (p < end) {
+		unsigned long cp = corpus_decode(&p, end, last);
+		if (cp >= NCODEPOINTS) {
+			prev = 0;
+			continue;
+		}
+		if (c->hist)
+			c->hist[cp]++;
+
+		int code = c->lookup ? c->lookup[cp] : 0;
+		if (!code) {
+			prev = 0;
+			continue;
+		}
+		int m = (code - 1) / (int) NSLOTS, i = (code - 1) % (int) NSLOTS;
+		c->freq[m][i]++;
+		if (prev && (prev - 1) / (int) NSLOTS == m)
+			c->bigram[m][(prev - 1) % (int) NSLOTS][i]++;
+		prev = code;
+	}
+}
+
+/*
+ * Stream version of count_chunk
+ */
+static size_t count_stream(void *arg, const unsigned char *buf, size_t len,
+		int last)
+{
+	const unsigned char *p = buf, *end = buf + len;
+	while (p < end) {
+		const unsigned char *q = p;
+		if (corpus_decode(&q, end, last) == CORPUS_PARTIAL)
+			break;
+		p = q;
+	}
+	count_chunk(arg, buf, p - buf, 1);
+	return p - buf;
+}
+
+/*
+ * Runs a counting pass over the corpus with one set of counts per thread
+ */
+static int count_corpus(char **files, int nfiles, struct counts **counts,
+		int nthreads)
+{
+	int i, ret = 0;
+	if (!nfiles)
+		return corpus_stream(STDIN_FILENO, count_stream, counts[0]);
+	for (i = 0; i < nfiles; i++)
+		ret |= corpus_map_file(files[i], count_chunk, (void **) counts,
+				nthreads);
+	return ret;
+}
+
+/*
+ * Fills the pools from the symbols currently in each map's slots
+ */
+static void pools_from_keymap(void)
+{
+	int m;
+	unsigned int i;
+	for (m = 0; m < NMAPS; m++) {
+		pools[m].n = 0;
+		for (i = 0; i < NSLOTS; i++) {
+			const struct chord_entry *e = &map[m][slots[i]];
+			if (e->type != TYPE_KEY || e->arg.code == NoSymbol) {
+				start_occ[m][i] = -1;
+				continue;
+			}
+			start_occ[m][i] = pools[m].n;
+			pools[m].syms[pools[m].n++] = e->arg.code;
+		}
+	}
+}
+
+/*
+ * Replaces the default map's symbols with the corpus's most frequent
+ * characters, for laying out other languages.  Those characters are dropped
+ * from the other maps.
+ */
+static void pool_from_corpus(const uint64_t *hist)
+{
+	static uint64_t folded[NCODEPOINTS];
+	unsigned long cp;
+	int m, i, j;
+
+	memset(folded, 0, sizeof(folded));
+	for (cp = 0x21; cp < NCODEPOINTS; cp++)
+		if (cp != 0x7f && !(cp >= 0x80 && cp <= 0xa0))
+			folded[fold(cp)] += hist[cp];
+
+	// Characters with fixed chords in the default map stay there
+	for (i = 0; i < 64; i++) {
+		unsigned int s;
+		for (s = 0; s < NSLOTS; s++)
+			if (slots[s] == (uint32_t) i)
+				break;
+		if (s == NSLOTS && map[0][i].type == TYPE_KEY)
+			folded[keysym_cp(map[0][i].arg.code)] = 0;
+	}
+	folded[0] = 0;
+
+	struct pool *p = &pools[0];
+	p->n = 0;
+	while (p->n < (int) NSLOTS) {
+		unsigned long top = 0;
+		for (cp = 1; cp < NCODEPOINTS; cp++)
+			if (folded[cp] > folded[top])
+				top = cp;
+		if (!folded[top])
+			break;
+		p->syms[p->n++] = revindex_keysym(top);
+		folded[top] = 0;
+	}
+	for (i = 0; i < (int) NSLOTS; i++)
+		start_occ[0][i] = i < p->n ? i : -1;
+
+	// Drop the chosen characters from the other maps.  The rest keep the
+	// slots they have in the current layout, and only the slots of those
+	// dropped are left empty.
+	for (m = 1; m < NMAPS; m++) {
+		int moved[NSLOTS];
+		int n = 0;
+		for (i = 0; i < pools[m].n; i++) {
+			for (j = 0; j < p->n; j++)
+				if (p->syms[j] == pools[m].syms[i])
+					break;
+			if (j < p->n) {
+				moved[i] = -1;
+				continue;
+			}
+			moved[i] = n;
+			pools[m].syms[n++] = pools[m].syms[i];
+		}
+		pools[m].n = n;
+		for (i = 0; i < (int) NSLOTS; i++)
+			if (start_occ[m][i] >= 0)
+				start_occ[m][i] = moved[start_occ[m][i]];
+	}
+}
+
+/*
+ * Prints a keysym as a kbd.py string: the character itself, or "_Name" for
+ * other keys
+ */
+static void print_json_sym(unsigned long sym)
+{
+	unsigned long cp = keysym_cp(sym);
+	if (sym == NoSymbol) {
+		printf("\"\"");
+	} else if (cp == '"' || cp == '\\') {
+		printf("\"\\%c\"", (char) cp);
+	} else if (cp) {
+		char utf8[5] = {0};
+		if (cp < 0x80) {
+			utf8[0] = cp;
+		} else if (cp < 0x800) {
+			utf8[0] = 0xc0 | (cp >> 6);
+			utf8[1] = 0x80 | (cp & 0x3f);
+		} else {
+			utf8[0] = 0xe0 | (cp >> 12);
+			utf8[1] = 0x80 | ((cp >> 6) & 0x3f);
+			utf8[2] = 0x80 | (cp & 0x3f);
+		}
+		printf("\"%s\"", utf8);
+	} else {
+		const char *name = XKeysymToString(sym);
+		printf("\"_%s\"", name ? name : "VoidSymbol");
+	}
+}
+
+/*
+ * Prints the optimized maps as kbd.py input
+ */
+static void print_json(int assign[NMAPS][NSLOTS])
+{
+	int m;
+	unsigned int i;
+	printf("{\n");
+	for (m = 0; m < NMAPS; m++) {
+		printf("\t\"%s\": {\n\t\t\"primary\": [", json_names[m]);
+		for (i = 0; i < NSLOTS; i++) {
+			if (i == NPRIMARY)
+				printf("],\n\t\t\"punctuation\": [");
+			else if (i)
+				printf(", ");
+			int s = assign[m][i];
+			print_json_sym(s < 0 ? NoSymbol : pools[m].syms[s]);
+		}
+		printf("]\n\t}%s\n", m < NMAPS - 1 ? "," : "");
+	}
+	printf("}\n");
+}
+
+/*
+ * Prints a keysym as it would appear in english_optimized.h
+ */
+static void print_c_sym(unsigned long sym)
+{
+	const char *name = XKeysymToString(sym);
+	if (sym == NoSymbol)
+		printf("NoSymbol");
+	else if (name && (sym & 0xff000000) != 0x01000000)
+		printf("XK_%s", name);
+	else
+		printf("%#lx", sym);
+}
+
+/*
+ * Prints the optimized keymap as a replacement for english_optimized.h
+ */
+static void print_header(int assign[NMAPS][NSLOTS])
+{
+	static const char *const types[] = {
+		[TYPE_NONE] = "NONE", [TYPE_KEY] = "KEY", [TYPE_MOD] = "MOD",
+		[TYPE_MODLOCK] = "MODLOCK", [TYPE_MAP] = "MAP",
+		[TYPE_MAPLOCK] = "MAPLOCK", [TYPE_MACRO] = "MACRO",
+	};
+	int m, c;
+	unsigned int i;
+
+	printf("#ifndef ENGLISH_OPTIMIZED_H_\n#define ENGLISH_OPTIMIZED_H_\n\n");
+	printf("#include <X11/Xlib.h>\n#include <X11/keysym.h>\n\n");
+	printf("#include \"chorder.h\"\n\nenum chordmap {\n");
+	for (m = 0; m < NMAPS; m++)
+		printf("\t%s,\n", enum_names[m]);
+	printf("};\n\nstruct chord_entry map[][64] = {\n");
+
+	for (m = 0; m < NMAPS; m++) {
+		printf("\t[%s] = {\n", enum_names[m]);
+		for (c = 0; c < 64; c++) {
+			struct chord_entry e = map[m][c];
+			for (i = 0; i < NSLOTS; i++) {
+				if (slots[i] != (uint32_t) c)
+					continue;
+				int s = assign[m][i];
+				e.type = s < 0 ? TYPE_NONE : TYPE_KEY;
+				e.arg.code = s < 0 ? NoSymbol : pools[m].syms[s];
+			}
+
+			printf("\t\t{.type=TYPE_%s, ", types[e.type]);
+			if (e.type == TYPE_MAP || e.type == TYPE_MAPLOCK) {
+				printf(".arg.map=%s},\n", enum_names[e.arg.map]);
+			} else {
+				printf(".arg.code=");
+				print_c_sym(e.type == TYPE_NONE ?
+						NoSymbol : e.arg.code);
+				printf("},\n");
+			}
+		}
+		printf("\t},\n");
+	}
+	printf("};\n\n#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	long iterations = 2000000;
+	int header = 0, from_corpus = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "cHi:j:")) != -1) {
+		switch (opt) {
+			case 'c':
+				from_corpus = 1;
+				break;
+			case 'H':
+				header = 1;
+				break;
+			case 'i':
+				iterations = atol(optarg);
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-c] [-H] [-i iterations] "
+						"[-j threads] [file...]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	if (iterations < 1)
+		iterations = 1;
+	if (from_corpus && optind == argc) {
+		fprintf(stderr, "-c needs corpus files\n");
+		return 1;
+	}
+
+	build_costs();
+	pools_from_keymap();
+
+	static uint16_t lookup[NCODEPOINTS];
+	struct counts **counts = calloc(nthreads, sizeof(counts[0]));
+	struct chain *chains = calloc(nthreads, sizeof(chains[0]));
+	pthread_t *tids = calloc(nthreads, sizeof(tids[0]));
+	int i, m, ret = 1;
+	for (i = 0; counts && i < nthreads; i++)
+		if (!(counts[i] = calloc(1, sizeof(*counts[i]))))
+			break;
+	if (!counts || !chains || !tids || i < nthreads) {
+		perror("calloc");
+		goto out;
+	}
+
+	// Pick the default map's characters from the corpus if asked
+	if (from_corpus) {
+		for (i = 0; i < nthreads; i++)
+			if (!(counts[i]->hist = calloc(NCODEPOINTS,
+						sizeof(uint64_t))))
+				goto out;
+		if (count_corpus(argv + optind, argc - optind, counts, nthreads))
+			goto out;
+		for (i = 1; i < nthreads; i++) {
+			unsigned long cp;
+			for (cp = 0; cp < NCODEPOINTS; cp++)
+				counts[0]->hist[cp] += counts[i]->hist[cp];
+		}
+		pool_from_corpus(counts[0]->hist);
+		for (i = 0; i < nthreads; i++) {
+			free(counts[i]->hist);
+			counts[i]->hist = NULL;
+		}
+	}
+
+	// Count each pool's symbols and bigrams
+	for (m = 0; m < NMAPS; m++) {
+		for (i = 0; i < pools[m].n; i++) {
+			unsigned long cp = keysym_cp(pools[m].syms[i]);
+			if (cp && cp < NCODEPOINTS && !lookup[cp]) {
+				lookup[cp] = m * NSLOTS + i + 1;
+				if (fold(cp) != cp)
+					continue;
+				// Uppercase shares the lowercase chord
+				unsigned long up;
+				for (up = 0x41; up < 0xdf; up++)
+					if (fold(up) == cp && up != cp)
+						lookup[up] = lookup[cp];
+			}
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		counts[i]->lookup = lookup;
+	if (count_corpus(argv + optind, argc - optind, counts, nthreads))
+		goto out;
+	for (m = 0; m < NMAPS; m++) {
+		int a, b, t;
+		for (t = 0; t < nthreads; t++) {
+			for (a = 0; a < pools[m].n; a++) {
+				pools[m].freq[a] += counts[t]->freq[m][a];
+				for (b = 0; b < pools[m].n; b++)
+					pools[m].bigram[a][b] +=
+						counts[t]->bigram[m][a][b];
+			}
+		}
+	}
+
+	// Anneal on every core and keep the best result for each map
+	for (i = 0; i < nthreads; i++) {
+		chains[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+		chains[i].iterations = iterations;
+	}
+	int started;
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, run_chain,
+					&chains[started]))
+			break;
+	for (i = started; i < nthreads; i++)
+		run_chain(&chains[i]);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	int best[NMAPS][NSLOTS];
+	for (m = 0; m < NMAPS; m++) {
+		int slot_of[NSLOTS];
+		unsigned int s;
+		for (s = 0; s < NSLOTS; s++)
+			if (start_occ[m][s] >= 0)
+				slot_of[start_occ[m][s]] = s;
+		double before = map_cost(&pools[m], slot_of);
+
+		int top = 0;
+		for (i = 1; i < nthreads; i++)
+			if (chains[i].best_cost[m] < chains[top].best_cost[m])
+				top = i;
+		memcpy(best[m], chains[top].best[m], sizeof(best[m]));
+		fprintf(stderr, "%s: %d symbols, cost %.0f -> %.0f\n",
+				json_names[m], pools[m].n, before,
+				chains[top].best_cost[m]);
+	}
+
+	if (header)
+		print_header(best);
+	else
+		print_json(best);
+	ret = 0;
+
+out:
+	for (i = 0; counts && i < nthreads; i++) {
+		if (counts[i])
+			free(counts[i]->hist);
+		free(counts[i]);
+	}
+	free(counts);
+	free(chains);
+	free(tids);
+	return ret;
+}
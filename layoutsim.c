@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "chorder.h"
+#include "corpus.h"
+#include "english_optimized.h"
+#include "revindex.h"
+
+/*
+ * Counts how much a corpus would cost to type on a keymap.  Each character is
+ * typed by the cheapest chord path to its keysym from the default map, as
+ * found in the reverse index; costs are totalled from a histogram of code
+ * points, so the per-byte work in the worker threads is just decoding.
+ */
+
+// Code points counted individually; anything above is lumped together
+#define NCODEPOINTS 0x10000
+
+/*
+ * Character counts gathered from part of a corpus
+ */
+struct histogram {
+	uint64_t count[NCODEPOINTS];
+	uint64_t astral;
+	uint64_t invalid;
+};
+
+/*
+ * Decodes UTF-8 into a histogram, returning the number of bytes used
+ */
+static size_t count_utf8(void *arg, const unsigned char *buf, size_t len,
+		int last)
+{
+	struct histogram *h = arg;
+	const unsigned char *p = buf, *end = buf + len;
+	while (p < end) {
+		// ASCII fast path
+		if (*p < 0x80) {
+			h->count[*p++]++;
+			continue;
+		}
+
+		unsigned long cp = corpus_decode(&p, end, last);
+		if (cp == CORPUS_PARTIAL)
+			break;
+		else if (cp == CORPUS_INVALID)
+			h->invalid++;
+		else if (cp < NCODEPOINTS)
+			h->count[cp]++;
+		else
+			h->astral++;
+	}
+	return p - buf;
+}
+
+/*
+ * Counts one piece of a mapped file
+ */
+static void count_chunk(void *arg, const unsigned char *buf, size_t len,
+		int last)
+{
+	count_utf8(arg, buf, len, last);
+}
+
+/*
+ * Returns the number of set bits
+ */
+static int popcount(uint32_t x)
+{
+	int n = 0;
+	for (; x; x &= x - 1)
+		n++;
+	return n;
+}
+
+/*
+ * Press handler for a chorder that is only used as a keymap
+ */
+static void no_press(void *arg, unsigned long code, int press)
+{
+	(void) arg;
+	(void) code;
+	(void) press;
+}
+
+int main(int argc, char **argv)
+{
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-j threads] [file...]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+
+	struct chorder kbd;
+	if (chorder_init(&kbd, (const struct chord_entry *) map,
+				sizeof(map) / sizeof(map[0]), 64, no_press, NULL))
+		return 1;
+
+	struct revindex ri;
+	if (revindex_build(&ri, &kbd)) {
+		chorder_destroy(&kbd);
+		return 1;
+	}
+
+	// One histogram per thread, merged into the first
+	struct histogram **hists = calloc(nthreads, sizeof(hists[0]));
+	int i, ret = 0;
+	for (i = 0; hists && i < nthreads; i++)
+		if (!(hists[i] = calloc(1, sizeof(*hists[i]))))
+			break;
+	if (!hists || i < nthreads) {
+		perror("calloc");
+		ret = 1;
+		goto out;
+	}
+
+	if (optind == argc)
+		ret = corpus_stream(STDIN_FILENO, count_utf8, hists[0]);
+	for (i = optind; i < argc; i++)
+		ret |= corpus_map_file(argv[i], count_chunk, (void **) hists,
+				nthreads);
+
+	struct histogram *h = hists[0];
+	for (i = 1; i < nthreads; i++) {
+		unsigned long cp;
+		for (cp = 0; cp < NCODEPOINTS; cp++)
+			h->count[cp] += hists[i]->count[cp];
+		h->astral += hists[i]->astral;
+		h->invalid += hists[i]->invalid;
+	}
+
+	// Total up costs from the histogram
+	uint64_t chars = h->astral, unmapped = h->astral, chords = 0;
+	uint64_t maps = 0, mods = 0, fingers = 0;
+	uint64_t load[32] = {0};
+	unsigned long cp;
+	for (cp = 0; cp < NCODEPOINTS; cp++) {
+		uint64_t n = h->count[cp];
+		if (!n)
+			continue;
+		chars += n;
+
+		const struct chord_path *p =
+			revindex_lookup(&ri, revindex_keysym(cp));
+		if (!p) {
+			unmapped += n;
+			continue;
+		}
+		chords += n * p->len;
+		maps += n * p->maps;
+		mods += n * p->mods;
+		int k, b;
+		for (k = 0; k < p->len; k++) {
+			fingers += n * popcount(p->codes[k]);
+			for (b = 0; b < 32; b++)
+				if (p->codes[k] & (1UL << b))
+					load[b] += n;
+		}
+	}
+
+	uint64_t typed = chars - unmapped;
+	printf("characters:      %" PRIu64 "\n", chars);
+	printf("unmapped:        %" PRIu64 "\n", unmapped);
+	printf("invalid bytes:   %" PRIu64 "\n", h->invalid);
+	printf("chords:          %" PRIu64 "\n", chords);
+	printf("map switches:    %" PRIu64 "\n", maps);
+	printf("mod presses:     %" PRIu64 "\n", mods);
+	if (typed) {
+		printf("chords per char: %.4f\n", (double) chords / typed);
+		printf("keys per chord:  %.4f\n", chords ?
+				(double) fingers / chords : 0.0);
+	}
+	printf("per-finger load:\n");
+	int b;
+	for (b = 0; b < 32; b++)
+		if (load[b])
+			printf("  bit %2d: %12" PRIu64 " (%.2f%%)\n", b, load[b],
+					fingers ? 100.0 * load[b] / fingers : 0);
+
+out:
+	for (i = 0; hists && i < nthreads; i++)
+		free(hists[i]);
+	free(hists);
+	revindex_destroy(&ri);
+	chorder_destroy(&kbd);
+	return ret;
+}
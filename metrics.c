@@ -0,0 +1,186 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+
+/*
+ * Creates the shared page, named after the current user
+ */
+int metrics_open(struct metrics *m)
+{
+	snprintf(m->name, sizeof(m->name), "%s%u", METRICS_NAME,
+			(unsigned int) getuid());
+
+	// Held mods say something about what is being typed, so only this user
+	// may read the page, even if an older one was left behind
+	int fd = shm_open(m->name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		perror(m->name);
+		return 1;
+	}
+	if (fchmod(fd, 0600)) {
+		perror("fchmod");
+		close(fd);
+		return 1;
+	}
+	if (ftruncate(fd, sizeof(*m->page))) {
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(m->name);
+		return 1;
+	}
+
+	m->page = mmap(NULL, sizeof(*m->page), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (m->page == MAP_FAILED) {
+		perror("mmap");
+		m->page = NULL;
+		shm_unlink(m->name);
+		return 1;
+	}
+
+	memset(m->page, 0, sizeof(*m->page));
+	m->page->version = METRICS_VERSION;
+	m->page->size = sizeof(*m->page);
+	return 0;
+}
+
+/*
+ * Removes the shared page
+ */
+void metrics_close(struct metrics *m)
+{
+	if (!m->page)
+		return;
+	munmap(m->page, sizeof(*m->page));
+	shm_unlink(m->name);
+	m->page = NULL;
+}
+
+/*
+ * Marks the page as being updated
+ */
+static void write_begin(struct metrics_page *p)
+{
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Marks the page as consistent again
+ */
+static void write_end(struct metrics_page *p)
+{
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies up to METRICS_MAX_MODS codes from a mod stack
+ */
+static uint32_t copy_mods(const struct mod_stack *mods, uint64_t *codes)
+{
+	uint32_t n;
+	for (n = 0; mods && n < METRICS_MAX_MODS; mods = mods->next)
+		codes[n++] = mods->code;
+	return n;
+}
+
+/*
+ * Counts an accepted touch
+ */
+void metrics_touch(struct metrics *m)
+{
+	if (!m->page)
+		return;
+	write_begin(m->page);
+	m->page->touches++;
+	write_end(m->page);
+}
+
+/*
+ * Counts a committed chord and publishes the chorder state it left behind
+ */
+void metrics_chord(struct metrics *m, const struct chorder *kbd,
+		int misfire)
+{
+	struct metrics_page *p = m->page;
+	if (!p)
+		return;
+
+	write_begin(p);
+	p->chords++;
+	p->misfires += !!misfire;
+	p->current_map = kbd->current_map;
+	p->maplock = kbd->maplock;
+	p->nmods = copy_mods(kbd->mods, p->mods);
+	p->nlocks = copy_mods(kbd->lockmods, p->locks);
+	write_end(p);
+}
+
+/*
+ * Adds a release-to-injection time to the latency histogram
+ */
+void metrics_latency(struct metrics *m, double us)
+{
+	if (!m->page)
+		return;
+
+	unsigned long t = us > 0 ? us : 0;
+	int i;
+	for (i = 0; i < METRICS_LATENCY_BUCKETS - 1 && t >> i; i++)
+		;
+	write_begin(m->page);
+	m->page->latency[i]++;
+	write_end(m->page);
+}
+
+/*
+ * Maps a published page read-only, returning NULL if there is none or its
+ * layout is not one we understand
+ */
+const struct metrics_page *metrics_attach(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+
+	const struct metrics_page *page = mmap(NULL, sizeof(*page),
+			PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	if (page->version != METRICS_VERSION ||
+			page->size != sizeof(*page)) {
+		fprintf(stderr, "%s: unknown metrics version %u\n", name,
+				page->version);
+		munmap((void *) page, sizeof(*page));
+		return NULL;
+	}
+	return page;
+}
+
+/*
+ * Takes a consistent copy of a page without disturbing the writer
+ */
+void metrics_read(const struct metrics_page *page, struct metrics_page *copy)
+{
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		memcpy(copy, page, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+			__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+}
@@ -0,0 +1,68 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+
+#include "chorder.h"
+
+// Layout version of the shared page; bumped whenever the layout changes
+#define METRICS_VERSION 1
+
+// Name of the shared memory object, followed by the user ID
+#define METRICS_NAME "/gkos-metrics-"
+
+// Number of power-of-two microsecond buckets for injection latency
+#define METRICS_LATENCY_BUCKETS 16
+
+// Most held or locked mods published
+#define METRICS_MAX_MODS 8
+
+/*
+ * Counters published in shared memory.  The writer makes seq odd while it
+ * updates the page, so a reader copies the page and retries if seq was odd or
+ * changed in the meantime.
+ */
+struct metrics_page {
+	uint32_t version;
+	uint32_t size;
+	uint32_t seq;
+	uint32_t current_map;
+	uint32_t maplock;
+	uint32_t nmods;
+	uint32_t nlocks;
+	uint32_t reserved;
+	// Chords committed, touches accepted, and chords which were unmapped
+	// or undone
+	uint64_t chords;
+	uint64_t touches;
+	uint64_t misfires;
+	// Time from the event which commits a chord (a release, the hold
+	// timer, or a command on the control socket) until its keys are
+	// flushed to the server: bucket i holds times below 2^i us, and the
+	// last bucket everything longer
+	uint64_t latency[METRICS_LATENCY_BUCKETS];
+	// Mods held and locked, innermost first
+	uint64_t mods[METRICS_MAX_MODS];
+	uint64_t locks[METRICS_MAX_MODS];
+};
+
+/*
+ * Writer's handle on the shared page
+ */
+struct metrics {
+	struct metrics_page *page;
+	char name[32];
+};
+
+int metrics_open(struct metrics *m);
+void metrics_close(struct metrics *m);
+
+void metrics_touch(struct metrics *m);
+void metrics_chord(struct metrics *m, const struct chorder *kbd,
+		int misfire);
+void metrics_latency(struct metrics *m, double us);
+
+const struct metrics_page *metrics_attach(const char *name);
+void metrics_read(const struct metrics_page *page, struct metrics_page *copy);
+
+#endif
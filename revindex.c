@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/keysym.h>
+
+#include "revindex.h"
+
+/*
+ * Growable list of candidate paths
+ */
+struct candidates {
+	struct revindex_entry *list;
+	unsigned long n, size;
+};
+
+/*
+ * Adds a candidate path for a keysym
+ */
+static int add_candidate(struct candidates *c, unsigned long sym,
+		const struct chord_path *path)
+{
+	if (c->n == c->size) {
+		unsigned long size = c->size ? 2 * c->size : 256;
+		struct revindex_entry *list = realloc(c->list,
+				size * sizeof(*list));
+		if (!list)
+			return 1;
+		c->list = list;
+		c->size = size;
+	}
+
+	c->list[c->n].sym = sym;
+	c->list[c->n].path = *path;
+	c->n++;
+	return 0;
+}
+
+/*
+ * Gets the chord code and entry at the given index within a map, returning
+ * NULL past the end of the map
+ */
+static struct chord_entry *map_entry(const struct chorder *kbd,
+		unsigned long map, unsigned long i, uint32_t *code)
+{
+	if (kbd->codes) {
+		if (kbd->map_start[map] + i >= kbd->map_start[map + 1])
+			return NULL;
+		*code = kbd->codes[kbd->map_start[map] + i];
+		return kbd->entries + kbd->map_start[map] + i;
+	}
+
+	if (i >= kbd->entries_per_map)
+		return NULL;
+	*code = i;
+	return kbd->entries + map * kbd->entries_per_map + i;
+}
+
+/*
+ * Returns the lowercase keysym for an uppercase Latin-1 letter, or NoSymbol
+ */
+static unsigned long unshifted(unsigned long sym)
+{
+	if (sym >= XK_A && sym <= XK_Z)
+		return sym - XK_A + XK_a;
+	if (sym >= XK_Agrave && sym <= XK_Thorn && sym != XK_multiply)
+		return sym - XK_Agrave + XK_agrave;
+	return NoSymbol;
+}
+
+/*
+ * Orders candidates by keysym, then by cost
+ */
+static int cmp_candidate(const void *a, const void *b)
+{
+	const struct revindex_entry *x = a, *y = b;
+	if (x->sym != y->sym)
+		return x->sym < y->sym ? -1 : 1;
+	return x->path.len - y->path.len;
+}
+
+/*
+ * Output recorded while replaying a path
+ */
+struct replay {
+	unsigned long last;
+	int shifted, shift;
+};
+
+/*
+ * Press handler which records what a replayed path types
+ */
+static void record_press(void *arg, unsigned long code, int press)
+{
+	struct replay *r = arg;
+	if (code == XK_Shift_L || code == XK_Shift_R)
+		r->shift = press;
+	else if (press) {
+		r->last = code;
+		r->shifted = r->shift;
+	}
+}
+
+/*
+ * Replays a path through a scratch copy of the chorder's state machine to
+ * check that it really types the keysym
+ */
+static int replay_path(const struct chorder *kbd, const struct chord_path *p,
+		unsigned long sym, unsigned long base)
+{
+	struct replay r = {.last = NoSymbol};
+	struct chorder sim = *kbd;
+	sim.current_map = 0;
+	sim.maplock = 0;
+	sim.recording = sim.binding = 0;
+	sim.counts = NULL;
+	sim.mods = sim.lockmods = sim.macromods = sim.macrolocks = NULL;
+	sim.press = record_press;
+	sim.arg = &r;
+
+	int i;
+	for (i = 0; i < p->len; i++)
+		if (chorder_press(&sim, p->codes[i]))
+			return 0;
+
+	// One-shot mods are all released by the final key
+	if (sim.mods || sim.lockmods)
+		return 0;
+	return r.last == base && r.shifted == (base != sym);
+}
+
+/*
+ * Builds the reverse index for a chorder's keymap.  Every keysym reachable
+ * by an optional Shift, an optional map switch and a key is considered, and
+ * the path with the fewest chords is kept.
+ */
+int revindex_build(struct revindex *ri, const struct chorder *kbd)
+{
+	struct candidates c = {NULL, 0, 0};
+	unsigned long i, j, m;
+	uint32_t code, mapcode, shiftcode = 0;
+	struct chord_entry *e;
+	int have_shift = 0;
+
+	// Find Shift in the default map
+	for (i = 0; (e = map_entry(kbd, 0, i, &code)); i++) {
+		if (e->type == TYPE_MOD && (e->arg.code == XK_Shift_L ||
+					e->arg.code == XK_Shift_R)) {
+			shiftcode = code;
+			have_shift = 1;
+			break;
+		}
+	}
+
+	for (m = 0; m < kbd->maps; m++) {
+		// Chord to reach this map from the default one, if needed
+		struct chord_path prefix = {.len = 0};
+		if (m) {
+			for (i = 0; (e = map_entry(kbd, 0, i, &mapcode)); i++)
+				if ((e->type == TYPE_MAP ||
+						e->type == TYPE_MAPLOCK) &&
+						e->arg.map == m)
+					break;
+			if (!e)
+				continue;
+			prefix.codes[prefix.len++] = mapcode;
+			prefix.maps = 1;
+		}
+
+		for (i = 0; (e = map_entry(kbd, m, i, &code)); i++) {
+			if (e->type != TYPE_KEY || e->arg.code == NoSymbol)
+				continue;
+
+			struct chord_path p = prefix;
+			p.codes[p.len++] = code;
+			if (add_candidate(&c, e->arg.code, &p))
+				goto err;
+
+			// Uppercase letters by way of Shift
+			unsigned long upper;
+			for (upper = XK_A; upper <= XK_Thorn; upper++)
+				if (unshifted(upper) == e->arg.code)
+					break;
+			if (!have_shift || upper > XK_Thorn)
+				continue;
+			struct chord_path sp = {.len = 0, .mods = 1};
+			sp.codes[sp.len++] = shiftcode;
+			for (j = 0; j < p.len; j++)
+				sp.codes[sp.len++] = p.codes[j];
+			sp.maps = p.maps;
+			if (add_candidate(&c, upper, &sp))
+				goto err;
+		}
+	}
+
+	// Keep the cheapest path for each keysym which survives replay
+	qsort(c.list, c.n, sizeof(c.list[0]), cmp_candidate);
+	ri->n = 0;
+	for (i = 0; i < c.n; i++) {
+		if (ri->n && c.list[ri->n - 1].sym == c.list[i].sym)
+			continue;
+		unsigned long base = unshifted(c.list[i].sym);
+		if (base == NoSymbol || !c.list[i].path.mods)
+			base = c.list[i].sym;
+		if (!replay_path(kbd, &c.list[i].path, c.list[i].sym, base))
+			continue;
+		c.list[ri->n++] = c.list[i];
+	}
+	ri->entries = c.list;
+	return 0;
+
+err:
+	perror("revindex");
+	free(c.list);
+	return 1;
+}
+
+/*
+ * Releases the memory used by a reverse index
+ */
+void revindex_destroy(struct revindex *ri)
+{
+	free(ri->entries);
+}
+
+/*
+ * Finds the cheapest path to a keysym, or NULL if it cannot be typed
+ */
+const struct chord_path *revindex_lookup(const struct revindex *ri,
+		unsigned long sym)
+{
+	unsigned long lo = 0, hi = ri->n;
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+		if (ri->entries[mid].sym < sym)
+			lo = mid + 1;
+		else if (ri->entries[mid].sym > sym)
+			hi = mid;
+		else
+			return &ri->entries[mid].path;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the keysym which types a Unicode code point
+ */
+unsigned long revindex_keysym(unsigned long cp)
+{
+	switch (cp) {
+		case '\n':
+			return XK_Return;
+		case '\t':
+			return XK_Tab;
+		case '\b':
+			return XK_BackSpace;
+	}
+	if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0))
+		return NoSymbol;
+	if (cp < 0x100)
+		return cp;
+	return 0x01000000 | cp;
+}
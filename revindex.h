@@ -0,0 +1,45 @@
+#ifndef REVINDEX_H_
+#define REVINDEX_H_
+
+#include <stdint.h>
+
+#include "chorder.h"
+
+// Longest chord sequence considered for a single keysym: mod, map, key
+#define REVINDEX_MAX_PATH 3
+
+/*
+ * Sequence of chords which types a keysym, starting from the default map
+ */
+struct chord_path {
+	uint32_t codes[REVINDEX_MAX_PATH];
+	uint8_t len;
+	// How many of the chords switch maps or press mods
+	uint8_t maps, mods;
+};
+
+/*
+ * Cheapest path to one keysym
+ */
+struct revindex_entry {
+	unsigned long sym;
+	struct chord_path path;
+};
+
+/*
+ * Reverse index from keysym to the cheapest chord path that types it
+ */
+struct revindex {
+	// Sorted by keysym
+	struct revindex_entry *entries;
+	unsigned long n;
+};
+
+int revindex_build(struct revindex *ri, const struct chorder *kbd);
+void revindex_destroy(struct revindex *ri);
+
+const struct chord_path *revindex_lookup(const struct revindex *ri,
+		unsigned long sym);
+unsigned long revindex_keysym(unsigned long cp);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/*
+ * Sets up empty statistics
+ */
+int stats_init(struct stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->confusion = calloc(STATS_MAX_CONFUSIONS, sizeof(st->confusion[0]));
+	if (!st->confusion) {
+		perror("calloc");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Releases the resources allocated for statistics
+ */
+void stats_destroy(struct stats *st)
+{
+	free(st->confusion);
+}
+
+/*
+ * Counts one more confusion of a chord with another, probing linearly from
+ * the pair's hash for its slot or an empty one.  The same chord in another
+ * map is a different pair.
+ */
+static void add_confusion(struct stats *st, unsigned long undone_map,
+		uint32_t undone, unsigned long replacement_map,
+		uint32_t replacement)
+{
+	uint32_t hash = ((undone ^ (uint32_t) undone_map << 24) *
+			UINT32_C(0x9e3779b1)) ^
+		(replacement ^ (uint32_t) replacement_map << 24);
+	hash *= UINT32_C(0x85ebca6b);
+	unsigned int i, n;
+	for (i = hash >> 20, n = 0; n < STATS_MAX_CONFUSIONS; i++, n++) {
+		struct confusion *c = &st->confusion[i % STATS_MAX_CONFUSIONS];
+		if (!c->count) {
+			*c = (struct confusion) {undone_map, undone,
+				replacement_map, replacement, 1};
+			return;
+		}
+		if (c->undone == undone && c->replacement == replacement &&
+				c->undone_map == undone_map &&
+				c->replacement_map == replacement_map) {
+			c->count++;
+			return;
+		}
+	}
+	st->dropped++;
+}
+
+/*
+ * Accounts for a chord committed in the given map.  An undo chord shortly after another marks
+ * that one as wrong, and the next chord other than an undo is taken as what
+ * was meant.
+ */
+void stats_chord(struct stats *st, unsigned long map, uint32_t code,
+		int undo, unsigned long time)
+{
+	if (st->last_time) {
+		unsigned long gap = time - st->last_time;
+		int i;
+		for (i = 0; i < STATS_INTERVAL_BUCKETS - 1 && gap >> i; i++)
+			;
+		st->intervals[i]++;
+	}
+
+	if (undo) {
+		if (st->last_time && !st->wrong &&
+				time - st->last_time <= STATS_UNDO_MS) {
+			st->wrong_map = st->last_map;
+			st->wrong_code = st->last_code;
+			st->wrong = 1;
+		}
+	} else if (st->wrong) {
+		add_confusion(st, st->wrong_map, st->wrong_code, map, code);
+		st->wrong = 0;
+	}
+
+	st->last_map = map;
+	st->last_code = code;
+	st->last_time = time;
+}
+
+/*
+ * Writes a snapshot of the statistics, replacing the file in one step so
+ * readers never see it half written
+ */
+int stats_save(const struct stats *st, const struct chorder *kbd,
+		const char *path)
+{
+	size_t len = strlen(path) + sizeof(".tmp");
+	char *tmp = malloc(len);
+	if (!tmp)
+		return 1;
+	snprintf(tmp, len, "%s.tmp", path);
+
+	FILE *f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		free(tmp);
+		return 1;
+	}
+
+	unsigned long i, map, code;
+	fprintf(f, "# entry map chord count\n");
+	for (i = 0; kbd->counts && i < kbd->nentries; i++) {
+		if (!kbd->counts[i])
+			continue;
+		chorder_entry_chord(kbd, i, &map, &code);
+		fprintf(f, "entry %lu %#lx %lu\n", map, code, kbd->counts[i]);
+	}
+
+	fprintf(f, "# confusion undone-map undone replacement-map "
+			"replacement count\n");
+	for (i = 0; i < STATS_MAX_CONFUSIONS; i++) {
+		const struct confusion *c = &st->confusion[i];
+		if (c->count)
+			fprintf(f, "confusion %lu %#lx %lu %#lx %lu\n",
+					c->undone_map,
+					(unsigned long) c->undone,
+					c->replacement_map,
+					(unsigned long) c->replacement,
+					c->count);
+	}
+	if (st->dropped)
+		fprintf(f, "confusion dropped %lu\n", st->dropped);
+
+	int j;
+	fprintf(f, "# interval below-ms count\n");
+	for (j = 0; j < STATS_INTERVAL_BUCKETS; j++) {
+		if (j < STATS_INTERVAL_BUCKETS - 1)
+			fprintf(f, "interval %lu %lu\n", 1UL << j,
+					st->intervals[j]);
+		else
+			fprintf(f, "interval inf %lu\n", st->intervals[j]);
+	}
+
+	int rv = fclose(f) != 0;
+	if (!rv && rename(tmp, path)) {
+		perror(path);
+		rv = 1;
+	}
+	free(tmp);
+	return rv;
+}
@@ -0,0 +1,65 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <inttypes.h>
+
+#include "chorder.h"
+
+// A chord undone within this many milliseconds counts as a confusion with the
+// chord that replaces it
+#define STATS_UNDO_MS 1500
+
+// Number of power-of-two millisecond buckets for gaps between chords
+#define STATS_INTERVAL_BUCKETS 16
+
+// How often (ms) the statistics are written out
+#define STATS_SNAPSHOT_MS 60000
+
+// Number of distinct confusions kept (a power of two); pairs seen once the
+// table is full are only counted as dropped
+#define STATS_MAX_CONFUSIONS 4096
+
+/*
+ * How often one chord was undone and replaced by another, each with the map
+ * it was typed in
+ */
+struct confusion {
+	unsigned long undone_map;
+	uint32_t undone;
+	unsigned long replacement_map;
+	uint32_t replacement;
+	unsigned long count;
+};
+
+/*
+ * Usage and error statistics for tuning the layout.  Per-entry counts are
+ * kept by the chorder itself.
+ */
+struct stats {
+	// Hash table of confusions, with unused slots at a count of zero, and
+	// the number of confusions which did not fit
+	struct confusion *confusion;
+	unsigned long dropped;
+	// Gaps between chords: bucket i holds gaps below 2^i ms, and the last
+	// bucket everything longer
+	unsigned long intervals[STATS_INTERVAL_BUCKETS];
+
+	// Last chord, its map and when it was committed (0 if none yet), and
+	// the chord which was undone if we are waiting for its replacement
+	unsigned long last_map;
+	uint32_t last_code;
+	unsigned long last_time;
+	unsigned long wrong_map;
+	uint32_t wrong_code;
+	unsigned int wrong : 1;
+};
+
+int stats_init(struct stats *st);
+void stats_destroy(struct stats *st);
+
+void stats_chord(struct stats *st, unsigned long map, uint32_t code,
+		int undo, unsigned long time);
+int stats_save(const struct stats *st, const struct chorder *kbd,
+		const char *path);
+
+#endif
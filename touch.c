@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/keysym.h>
+
+#include "gkos.h"
+
+/*
+ * Shifted letters, used as the long-press variants of the letter chords
+ */
+static struct chord_entry capitals[26][3];
+
+/*
+ * Gives the RECORD_SYM chord a long-press variant which records a macro, and
+ * the chord switching to undo_map one which undoes the last chord (map
+ * switches never autorepeat, so holding one is free to use).  If
+ * capitals is set, every letter chord also gets one which types the capital
+ * letter; this takes the hold away from autorepeat, so it is only done when
+ * autorepeat is off.
+ */
+int set_long_variants(struct chorder *kbd, unsigned long undo_map,
+		int capitals_on)
+{
+	struct chord_entry *longmap = calloc(kbd->nentries, sizeof(*longmap));
+	if (!longmap)
+		return 1;
+
+	unsigned long i;
+	for (i = 0; i < kbd->nentries; i++) {
+		const struct chord_entry *e = &kbd->entries[i];
+		if (e->type == TYPE_MAP && e->arg.map == undo_map)
+			longmap[i].type = TYPE_UNDO;
+		if (e->type != TYPE_KEY)
+			continue;
+
+		unsigned long sym = e->arg.code;
+		if (sym == RECORD_SYM)
+			longmap[i].type = TYPE_RECORD;
+		if (!capitals_on || sym < XK_a || sym > XK_z)
+			continue;
+
+		struct chord_entry *cap = capitals[sym - XK_a];
+		cap[0] = (struct chord_entry) {.type = TYPE_MOD,
+			.arg.code = XK_Shift_L};
+		cap[1] = (struct chord_entry) {.type = TYPE_KEY,
+			.arg.code = sym};
+		cap[2] = (struct chord_entry) {.type = TYPE_NONE};
+		longmap[i] = (struct chord_entry) {.type = TYPE_MACRO,
+			.arg.ptr = cap};
+	}
+
+	int rv = chorder_set_long(kbd, longmap);
+	free(longmap);
+	return rv;
+}
+
+/*
+ * Allocates room for tracking up to ntouches touches at once.  Settings
+ * already in the tracker (autorepeat, per-hand mode) are kept.
+ */
+int touch_init(struct touch_tracker *t, int ntouches, struct chorder *kbd,
+		const struct touch_ops *ops, void *arg)
+{
+	t->ntouches = ntouches;
+	t->chorder = kbd;
+	t->ops = ops;
+	t->arg = arg;
+	t->touches = calloc(ntouches, sizeof(t->touches[0]));
+	t->touchids = calloc(ntouches, sizeof(t->touchids[0]));
+	t->touchpts = calloc(ntouches, sizeof(t->touchpts[0]));
+	t->swipes = calloc(ntouches, sizeof(t->swipes[0]));
+
+	if (!t->touches || !t->touchids || !t->touchpts || !t->swipes) {
+		touch_destroy(t);
+		return 1;
+	}
+	touch_clear(t);
+	return 0;
+}
+
+/*
+ * Frees the tracker's touch slots
+ */
+void touch_destroy(struct touch_tracker *t)
+{
+	free(t->swipes);
+	free(t->touchpts);
+	free(t->touchids);
+	free(t->touches);
+	t->swipes = NULL;
+	t->touchpts = NULL;
+	t->touchids = NULL;
+	t->touches = NULL;
+}
+
+/*
+ * Gives the tracker the buttons touches are tested against
+ */
+void touch_set_layout(struct touch_tracker *t, struct layout_btn *btns,
+		int nbtns, int hand_bits)
+{
+	t->btns = btns;
+	t->nbtns = nbtns;
+	t->hand_bits = hand_bits;
+}
+
+/*
+ * Forgets all touches currently being tracked
+ */
+void touch_clear(struct touch_tracker *t)
+{
+	memset(t->touches, 0, t->ntouches * sizeof(t->touches[0]));
+	memset(t->touchids, 0, t->ntouches * sizeof(t->touchids[0]));
+	t->active = 0;
+	memset(t->hands, 0, sizeof(t->hands));
+	t->merged = 0;
+	t->hold_hand = -1;
+	t->repeat_sym = NoSymbol;
+	t->repeat_next = 0;
+}
+
+/*
+ * Returns the button structure, if any, whose hit region contains the given
+ * coordinates
+ */
+struct layout_btn *touch_hit(struct touch_tracker *t, double x, double y)
+{
+	int i;
+	for (i = 0; i < t->nbtns; i++)
+		if (layout_hit(&t->btns[i], x, y))
+			return &t->btns[i];
+	return NULL;
+}
+
+/*
+ * Calculate the bits corresponding to the currently touched buttons
+ */
+uint32_t touch_pressed_bits(const struct touch_tracker *t)
+{
+	uint32_t bits = 0;
+	int i;
+	for (i = 0; i < t->ntouches; i++)
+		if (t->touchids[i] && t->touches[i])
+			bits |= t->touches[i]->bits;
+	return bits;
+}
+
+/*
+ * Returns which hand's bank a button belongs to (0 left, 1 right)
+ */
+static int btn_hand(const struct touch_tracker *t,
+		const struct layout_btn *btn)
+{
+	return (btn->bits >> t->hand_bits) != 0;
+}
+
+/*
+ * Returns the chord bits belonging to the given hand
+ */
+static uint32_t hand_mask(const struct touch_tracker *t, int hand)
+{
+	uint32_t mask = (UINT32_C(1) << t->hand_bits) - 1;
+	return hand ? mask << t->hand_bits : mask;
+}
+
+/*
+ * Notes that a touch has landed on a button, so its chord should commit on
+ * the next release.  In per-hand mode this is the chord of the button's hand
+ * alone, unless the other hand's chord began just before, in which case the
+ * two make a single chord across both hands.
+ */
+static void start_chord(struct touch_tracker *t, struct layout_btn *btn,
+		double now)
+{
+	if (!t->per_hand) {
+		t->active = 1;
+		return;
+	}
+
+	int h = btn_hand(t, btn);
+	struct hand_chord *hc = &t->hands[h];
+	struct hand_chord *other = &t->hands[!h];
+	if (hc->active)
+		return;
+
+	hc->active = 1;
+	hc->start = now;
+	if (other->active && hc->start - other->start <= HAND_SYNC_MS * 1e3)
+		t->merged = 1;
+}
+
+/*
+ * Abandons the chord a touch was part of
+ */
+static void cancel_chord(struct touch_tracker *t, int idx)
+{
+	int h = t->touchpts[idx].hand;
+
+	t->active = 0;
+	if (h < 0)
+		return;
+	if (t->merged)
+		memset(t->hands, 0, sizeof(t->hands));
+	else
+		t->hands[h].active = 0;
+	t->merged = 0;
+}
+
+/*
+ * Gets the bits of the chord which a hold would commit: the whole keyboard's,
+ * or in per-hand mode that of the given hand (or of both, if they landed
+ * together).  Returns 0 if no such chord is waiting to commit.
+ */
+static int hold_chord(const struct touch_tracker *t, int h, uint32_t *bits)
+{
+	*bits = touch_pressed_bits(t);
+	if (!t->per_hand)
+		return t->active;
+	if (h < 0 || !t->hands[h].active)
+		return 0;
+	if (!t->merged)
+		*bits &= hand_mask(t, h);
+	return 1;
+}
+
+/*
+ * Marks the chord a hold commits as done, so its release commits nothing
+ */
+static void end_hold_chord(struct touch_tracker *t)
+{
+	t->active = 0;
+	if (!t->per_hand)
+		return;
+	if (t->merged)
+		memset(t->hands, 0, sizeof(t->hands));
+	else
+		t->hands[t->hold_hand].active = 0;
+	t->merged = 0;
+}
+
+/*
+ * Starts timing how long the current chord is held, in per-hand mode that of
+ * the given hand.  A chord with a long-press variant waits for its map's
+ * threshold; any other may autorepeat.
+ */
+static void arm_hold(struct touch_tracker *t, int h, double now)
+{
+	struct chorder *kbd = t->chorder;
+	uint32_t bits;
+
+	t->repeat_sym = NoSymbol;
+	t->repeat_next = 0;
+	t->hold_hand = h;
+	if (!hold_chord(t, h, &bits))
+		return;
+
+	if (chorder_get_long(kbd, kbd->current_map, bits))
+		t->repeat_next = now + kbd->long_ms[kbd->current_map] * 1e3;
+	else if (t->repeat_rate)
+		t->repeat_next = now + t->repeat_delay * 1e3;
+}
+
+/*
+ * Stops any autorepeat in progress
+ */
+static void stop_repeat(struct touch_tracker *t)
+{
+	t->repeat_sym = NoSymbol;
+	t->repeat_next = 0;
+}
+
+/*
+ * Remembers a button (NULL for none) as touched at the start of a touch, and
+ * starts a chord if it is on the keyboard
+ */
+int touch_begin(struct touch_tracker *t, struct layout_btn *btn, int touchid,
+		double x, double y, double now)
+{
+	int i;
+	for (i = 0; i < t->ntouches && t->touchids[i]; i++)
+		;
+	if (i >= t->ntouches) {
+		fprintf(stderr, "No open touch slots found\n");
+		return 1;
+	}
+
+	t->touches[i] = btn;
+	t->touchids[i] = touchid;
+	t->touchpts[i] = (struct touch_point) {
+		.x = x,
+		.y = y,
+		.hand = btn ? btn_hand(t, btn) : -1,
+	};
+	memset(&t->swipes[i], 0, sizeof(t->swipes[i]));
+
+	// Touches outside a button are remembered but start nothing
+	if (!btn)
+		return 0;
+
+	start_chord(t, btn, now);
+	arm_hold(t, t->touchpts[i].hand, now);
+	return 0;
+}
+
+/*
+ * Find the touch index corresponding to the given touch event ID
+ */
+int touch_index(const struct touch_tracker *t, int touchid)
+{
+	int i;
+	for (i = 0; i < t->ntouches; i++)
+		if (t->touchids[i] == touchid)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Returns 1 if two or more touches are being held outside the keyboard,
+ * the gesture for getting it out of the way.  Touches which started on the
+ * keyboard and slid off it count, so the gesture needs no touches from
+ * outside it.
+ */
+int touch_dismissed(const struct touch_tracker *t)
+{
+	int misses = 0;
+	int i;
+	for (i = 0; i < t->ntouches; i++)
+		if (t->touchids[i] && !t->touches[i] && ++misses >= 2)
+			return 1;
+	return 0;
+}
+
+/*
+ * Tracks a finger sweeping along a ring as it slides from one button to
+ * another.  Returns the keysym of a recognized swipe, or NoSymbol.
+ */
+static KeySym track_swipe(const struct touch_tracker *t, struct swipe *sw,
+		const struct layout_btn *from, const struct layout_btn *to)
+{
+	// Moving to a neighbor on the same ring?
+	int dir = 0;
+	if (from && to && from->cx == to->cx && from->cy == to->cy &&
+			from->r1 == to->r1) {
+		if (to->th == from->th + from->dth)
+			dir = 1;
+		else if (from->th == to->th + to->dth)
+			dir = -1;
+	}
+
+	// The left bank's arcs run clockwise toward the center
+	if (to && to - t->btns < t->nbtns / 2)
+		dir = -dir;
+
+	if (!dir) {
+		sw->dir = sw->steps = 0;
+		return NoSymbol;
+	}
+	if (dir != sw->dir) {
+		sw->dir = dir;
+		sw->steps = 0;
+	}
+
+	// Each step past the threshold repeats the gesture
+	if (++sw->steps < SWIPE_STEPS)
+		return NoSymbol;
+	return dir > 0 ? SWIPE_FORWARD_SYM : SWIPE_BACKWARD_SYM;
+}
+
+/*
+ * Follows a touch as it slides, updating the pressed set and recognizing
+ * swipes.  A touch that moves onto a different button starts its chord's
+ * hold over.
+ */
+int touch_move(struct touch_tracker *t, int idx, double x, double y,
+		double now)
+{
+	t->touchpts[idx].x = x;
+	t->touchpts[idx].y = y;
+
+	struct layout_btn *btn = touch_hit(t, x, y);
+	if (btn == t->touches[idx])
+		return 0;
+
+	struct swipe *sw = &t->swipes[idx];
+	KeySym sym = track_swipe(t, sw, t->touches[idx], btn);
+	t->touches[idx] = btn;
+
+	if (sym != NoSymbol) {
+		// A swipe takes the place of the chord this touch was part of
+		cancel_chord(t, idx);
+		sw->fired = 1;
+		if (t->ops->swipe(t->arg, sym))
+			return 1;
+	} else if (btn && !sw->fired) {
+		if (t->touchpts[idx].hand < 0)
+			t->touchpts[idx].hand = btn_hand(t, btn);
+		start_chord(t, btn, now);
+	}
+
+	arm_hold(t, t->touchpts[idx].hand, now);
+	return 0;
+}
+
+/*
+ * Commits whatever chord is waiting on the release of the given touch, then
+ * forgets the touch.  In per-hand mode that is the chord of the touch's hand,
+ * or of both hands if they landed together.  Any release ends autorepeat.
+ */
+int touch_end(struct touch_tracker *t, int idx, unsigned long time)
+{
+	uint32_t bits = touch_pressed_bits(t);
+	int commit = 1;
+
+	stop_repeat(t);
+	if (!t->per_hand) {
+		commit = t->active;
+		t->active = 0;
+	} else {
+		int h = t->touchpts[idx].hand;
+		if (h < 0 || !t->hands[h].active) {
+			commit = 0;
+		} else {
+			if (!t->merged)
+				bits &= hand_mask(t, h);
+			cancel_chord(t, idx);
+		}
+	}
+
+	int rv = commit && t->ops->commit(t->arg, bits, time, TOUCH_RELEASED);
+	t->touches[idx] = NULL;
+	t->touchids[idx] = 0;
+	return rv;
+}
+
+/*
+ * Runs the hold timer.  A chord held past its long-press threshold commits
+ * its long variant right away.  Otherwise a plain key chord held past the
+ * autorepeat delay is committed without waiting for a release, then repeated
+ * at the configured rate for as long as it stays held.  Each repeat is a
+ * full press and release, so no key is ever left down.
+ */
+int touch_run_hold(struct touch_tracker *t, double now, unsigned long time)
+{
+	struct chorder *kbd = t->chorder;
+	double period = 1e6 / t->repeat_rate;
+
+	if (t->repeat_sym == NoSymbol) {
+		uint32_t bits;
+		int held = hold_chord(t, t->hold_hand, &bits);
+		if (held && chorder_get_long(kbd, kbd->current_map, bits)) {
+			stop_repeat(t);
+			end_hold_chord(t);
+			return t->ops->commit(t->arg, bits, time, TOUCH_HELD);
+		}
+
+		const struct chord_entry *e = held ? chorder_get_entry(kbd,
+				kbd->current_map, bits) : NULL;
+		if (!e || e->type != TYPE_KEY || !t->repeat_rate) {
+			stop_repeat(t);
+			return 0;
+		}
+
+		// The chord releases its one-shot mods once the key is typed,
+		// so remember them for the repeats
+		const struct mod_stack *m;
+		int n = 0;
+		for (m = kbd->mods; m; m = m->next)
+			n++;
+		t->repeat_nmods = 0;
+		for (m = kbd->mods; m; m = m->next, n--)
+			if (n <= REPEAT_MAX_MODS) {
+				t->repeat_mods[n - 1] = m->code;
+				t->repeat_nmods++;
+			}
+
+		t->repeat_sym = e->arg.code;
+		t->repeat_next = now + period;
+		end_hold_chord(t);
+		return t->ops->commit(t->arg, bits, time, TOUCH_REPEATED);
+	}
+
+	// Emit every repeat that has come due in one burst, dropping any
+	// backlog beyond that
+	int n;
+	for (n = 0; t->repeat_next <= now && n < REPEAT_MAX_BURST; n++) {
+		t->ops->repeat(t->arg, t->repeat_sym);
+		t->repeat_next += period;
+	}
+	if (t->repeat_next <= now)
+		t->repeat_next = now + period;
+	return 0;
+}
@@ -0,0 +1,458 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "gkos.h"
+#include "english_optimized.h"
+
+/*
+ * Types a stream of chords with simulated fingers and counts how many come out
+ * wrong.  Each chord becomes one touch per hand on the button for that hand's
+ * half, landing and lifting with Gaussian timing jitter and scattered around
+ * the button's centre, with the odd stray touch thrown in.  The touches are
+ * fed to the same touch tracker gkos uses, with its keymap, so no X server is
+ * needed and whatever gkos would commit counts: held chords which autorepeat
+ * or type their long-press variant are misfires too.
+ */
+
+// Chords typed at each rate
+#define DEF_CHORDS 2000
+// Fastest rate tried, in chords per second
+#define MAX_RATE 25
+// Fraction of the time between chords that each one is held, up to a limit
+// (ms), as fingers lift once a chord is down however slowly chords come
+#define HOLD_FRAC 0.5
+#define HOLD_MAX_MS 200
+// How long a stray touch stays down (ms)
+#define STRAY_MS 30
+// Most touches tracked at once, as in gkos
+#define MAX_TOUCHES 10
+
+/*
+ * How a typist's fingers deviate from the ideal: standard deviations of
+ * landing and lifting times (ms) and of position (px), and the chance of a
+ * stray touch during any chord
+ */
+struct model {
+	const char *name;
+	double land, lift, pos;
+	double stray;
+};
+
+static const struct model default_models[] = {
+	{"careful", 5, 10, 4, 0.001},
+	{"typical", 10, 15, 6, 0.003},
+	{"hurried", 20, 30, 8, 0.005},
+};
+
+/*
+ * A finger landing on or lifting from the screen
+ */
+struct touch_ev {
+	double t;
+	int id;
+	int begin;
+	double x, y;
+};
+
+/*
+ * Buttons placed as gkos would place them
+ */
+static struct layout_btn *btns;
+static int nbtns, hand_bits;
+
+/*
+ * Touch tracker and keymap, as in gkos
+ */
+static struct touch_tracker tracker = {
+	.repeat_delay = REPEAT_DELAY,
+	.repeat_rate = REPEAT_RATE,
+};
+static struct chorder kbd;
+
+/*
+ * What the tracker has typed.  Chords are kept as their bits, with a long
+ * press or a swipe marked above them so it never matches a plain chord.
+ */
+#define COMMIT_HELD (UINT64_C(1) << 32)
+#define COMMIT_SWIPE (UINT64_C(2) << 32)
+static uint64_t *commits;
+static int ncommits, max_commits;
+
+/*
+ * State of the random number generator
+ */
+static uint64_t rng = 88172645463325252ULL;
+
+/*
+ * Returns a uniform random number in (0, 1]
+ */
+static double uniform(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng * 2685821657736338717ULL >> 11) + 1) * 0x1p-53;
+}
+
+/*
+ * Returns a normally distributed random number with the given deviation
+ */
+static double gauss(double sd)
+{
+	return sd * sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+/*
+ * Finds the button which types exactly the given chord bits
+ */
+static const struct layout_btn *find_btn(uint32_t bits)
+{
+	int i;
+	for (i = 0; i < nbtns; i++)
+		if (btns[i].bits == bits)
+			return &btns[i];
+	return NULL;
+}
+
+/*
+ * Notes something typed, dropping anything past the end of the buffer
+ */
+static void note_commit(uint64_t code)
+{
+	if (ncommits < max_commits)
+		commits[ncommits++] = code;
+}
+
+/*
+ * Tracker callback for a committed chord
+ */
+static int sim_commit(void *arg, uint32_t bits, unsigned long time,
+		enum touch_commit how)
+{
+	(void) arg;
+	(void) time;
+	note_commit(bits | (how == TOUCH_HELD ? COMMIT_HELD : 0));
+	return 0;
+}
+
+/*
+ * Tracker callback for a swipe
+ */
+static int sim_swipe(void *arg, KeySym sym)
+{
+	(void) arg;
+	note_commit(sym | COMMIT_SWIPE);
+	return 0;
+}
+
+/*
+ * Tracker callback for an autorepeat, which types the chord committed just
+ * before once more
+ */
+static void sim_repeat(void *arg, KeySym sym)
+{
+	(void) arg;
+	(void) sym;
+	if (ncommits)
+		note_commit(commits[ncommits - 1]);
+}
+
+static const struct touch_ops sim_ops = {
+	.commit = sim_commit,
+	.swipe = sim_swipe,
+	.repeat = sim_repeat,
+};
+
+/*
+ * Chorder output, which goes nowhere
+ */
+static void sim_press(void *arg, unsigned long sym, int press)
+{
+	(void) arg;
+	(void) sym;
+	(void) press;
+}
+
+/*
+ * Adds a touch near the middle of a button
+ */
+static void add_touch(struct touch_ev *ev, int *nev, int id,
+		const struct layout_btn *btn, double pos, double t1, double t2)
+{
+	double r = (btn->r1 + btn->r2) / 2.0;
+	double th = M_PI * (btn->th + btn->dth / 2.0) / 11520.0;
+	double x = btn->cx + r * cos(th) + gauss(pos);
+	double y = btn->cy - r * sin(th) + gauss(pos);
+
+	// A finger can't lift before it lands
+	if (t2 < t1 + 1)
+		t2 = t1 + 1;
+	ev[(*nev)++] = (struct touch_ev) {t1, id, 1, x, y};
+	ev[(*nev)++] = (struct touch_ev) {t2, id, 0, x, y};
+}
+
+/*
+ * Orders touch events by time, lifts first
+ */
+static int cmp_ev(const void *a, const void *b)
+{
+	const struct touch_ev *ea = a, *eb = b;
+	if (ea->t != eb->t)
+		return ea->t < eb->t ? -1 : 1;
+	return ea->begin - eb->begin;
+}
+
+/*
+ * Generates the touches for typing n random chords at the given period (ms),
+ * returning the number of events
+ */
+static int generate(const struct model *m, double period, int n,
+		uint64_t *targets, struct touch_ev *ev)
+{
+	uint32_t mask = (UINT32_C(1) << hand_bits) - 1;
+	double hold = HOLD_FRAC * period;
+	int i, h, nev = 0, id = 1;
+
+	if (hold > HOLD_MAX_MS)
+		hold = HOLD_MAX_MS;
+
+	for (i = 0; i < n; i++) {
+		double t0 = i * period;
+		uint32_t code;
+
+		// Pick a chord every half of which has a button
+		do
+			code = uniform() * (UINT32_C(1) << (2 * hand_bits));
+		while (!code || ((code & mask) && !find_btn(code & mask)) ||
+				((code & ~mask) && !find_btn(code & ~mask)));
+		targets[i] = code;
+
+		for (h = 0; h < 2; h++) {
+			uint32_t half = code & (h ? ~mask : mask);
+			if (!half)
+				continue;
+			add_touch(ev, &nev, id++, find_btn(half), m->pos,
+					t0 + gauss(m->land),
+					t0 + hold + gauss(m->lift));
+		}
+
+		// A brush against some button while the chord is formed
+		if (uniform() < m->stray) {
+			double t = t0 + uniform() * period;
+			add_touch(ev, &nev, id++, &btns[(int) (uniform() * nbtns)
+					% nbtns], m->pos, t, t + STRAY_MS);
+		}
+	}
+
+	qsort(ev, nev, sizeof(ev[0]), cmp_ev);
+	return nev;
+}
+
+/*
+ * Replays touch events through the touch tracker, returning the number of
+ * things typed.  Touches off the keyboard are passed on, as gkos does unless
+ * it owns every touch, and the hold timer fires wherever it would have
+ * between events.
+ */
+static int replay(const struct touch_ev *ev, int nev)
+{
+	int i;
+
+	ncommits = 0;
+	touch_clear(&tracker);
+	for (i = 0; i < nev; i++) {
+		double now = ev[i].t * 1e3;
+		while (tracker.repeat_next && tracker.repeat_next <= now)
+			touch_run_hold(&tracker, tracker.repeat_next,
+					tracker.repeat_next / 1e3);
+
+		if (ev[i].begin) {
+			struct layout_btn *btn = touch_hit(&tracker, ev[i].x,
+					ev[i].y);
+			if (btn)
+				touch_begin(&tracker, btn, ev[i].id, ev[i].x,
+						ev[i].y, now);
+			continue;
+		}
+
+		int idx = touch_index(&tracker, ev[i].id);
+		if (idx >= 0)
+			touch_end(&tracker, idx, ev[i].t);
+	}
+	return ncommits;
+}
+
+/*
+ * Returns the edit distance between the chords meant and those typed
+ */
+static int distance(const uint64_t *a, int na, const uint64_t *b, int nb,
+		int *row)
+{
+	int i, j;
+	for (j = 0; j <= nb; j++)
+		row[j] = j;
+	for (i = 1; i <= na; i++) {
+		int diag = row[0];
+		row[0] = i;
+		for (j = 1; j <= nb; j++) {
+			int d = diag + (a[i - 1] != b[j - 1]);
+			diag = row[j];
+			if (row[j] + 1 < d)
+				d = row[j] + 1;
+			if (row[j - 1] + 1 < d)
+				d = row[j - 1] + 1;
+			row[j] = d;
+		}
+	}
+	return row[nb];
+}
+
+int main(int argc, char **argv)
+{
+	int nchords = DEF_CHORDS;
+	double threshold = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:pr:S:t:")) != -1) {
+		switch (opt) {
+			case 'n':
+				nchords = atoi(optarg);
+				break;
+			case 'p':
+				tracker.per_hand = 1;
+				break;
+			case 'r':
+				if (sscanf(optarg, "%d,%d", &tracker.repeat_delay,
+							&tracker.repeat_rate) != 2 ||
+						tracker.repeat_delay < 0 ||
+						tracker.repeat_rate < 0) {
+					fprintf(stderr, "bad repeat %s\n",
+							optarg);
+					return 1;
+				}
+				break;
+			case 'S':
+				rng = strtoull(optarg, NULL, 0);
+				break;
+			case 't':
+				threshold = atof(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p] [-n chords] "
+						"[-r delay,rate] [-S seed] [-t misfire%%] "
+						"[land,lift,pos,stray...]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (nchords < 1)
+		nchords = 1;
+	if (!rng)
+		rng = 1;
+
+	// Models given on the command line replace the built-in ones
+	int nmodels = argc - optind, i;
+	const struct model *models = default_models;
+	struct model *custom = NULL;
+	if (nmodels) {
+		models = custom = calloc(nmodels, sizeof(custom[0]));
+		if (!custom) {
+			perror("calloc");
+			return 1;
+		}
+		for (i = 0; i < nmodels; i++) {
+			struct model *m = &custom[i];
+			m->name = argv[optind + i];
+			if (sscanf(m->name, "%lf,%lf,%lf,%lf", &m->land,
+						&m->lift, &m->pos,
+						&m->stray) != 4) {
+				fprintf(stderr, "bad model %s\n", m->name);
+				free(custom);
+				return 1;
+			}
+		}
+	} else {
+		nmodels = sizeof(default_models) / sizeof(default_models[0]);
+	}
+
+	// Lay the buttons out on a screen wide enough that the banks are apart
+	nbtns = num_default_btns * 2;
+	btns = calloc(nbtns, sizeof(btns[0]));
+	uint64_t *targets = calloc(nchords, sizeof(targets[0]));
+	max_commits = nchords * 3;
+	commits = calloc(max_commits, sizeof(commits[0]));
+	struct touch_ev *ev = calloc(nchords * 6, sizeof(ev[0]));
+	int *row = calloc(nchords * 3 + 1, sizeof(row[0]));
+	int *best = calloc(nmodels, sizeof(best[0]));
+	int ret = 1;
+	if (!btns || !targets || !commits || !ev || !row || !best) {
+		perror("calloc");
+		goto out;
+	}
+	int rows = 0;
+	for (i = 0; i < num_default_btns; i++)
+		if (default_btns[i].row >= rows)
+			rows = default_btns[i].row + 1;
+	hand_bits = layout_place(btns, default_btns, num_default_btns,
+			2 * (IR + rows * DR) + 1);
+
+	if (chorder_init(&kbd, (const struct chord_entry *) map,
+				sizeof(map) / sizeof(map[0]),
+				sizeof(map[0]) / sizeof(map[0][0]), sim_press,
+				NULL))
+		goto out;
+	if (set_long_variants(&kbd, MAP_SYMBOLS, !tracker.repeat_rate) ||
+			touch_init(&tracker, MAX_TOUCHES, &kbd, &sim_ops,
+				NULL)) {
+		fprintf(stderr, "Failed to set up the touch tracker\n");
+		goto out_chorder;
+	}
+	touch_set_layout(&tracker, btns, nbtns, hand_bits);
+
+	printf("%-6s", "rate");
+	for (i = 0; i < nmodels; i++)
+		printf(" %10.10s", models[i].name);
+	printf("\n");
+
+	int rate;
+	for (rate = 1; rate <= MAX_RATE; rate++) {
+		printf("%-6d", rate);
+		for (i = 0; i < nmodels; i++) {
+			int nev = generate(&models[i], 1000.0 / rate, nchords,
+					targets, ev);
+			int n = replay(ev, nev);
+			double misfire = 100.0 * distance(targets, nchords,
+					commits, n, row) / nchords;
+			printf(" %9.2f%%", misfire);
+
+			// Only count rates reached without a slower one failing
+			if (misfire <= threshold && best[i] == rate - 1)
+				best[i] = rate;
+		}
+		printf("\n");
+	}
+
+	printf("%-6s", "max");
+	for (i = 0; i < nmodels; i++)
+		printf(" %10d", best[i]);
+	printf("\n");
+	ret = 0;
+
+	touch_destroy(&tracker);
+out_chorder:
+	chorder_destroy(&kbd);
+out:
+	free(best);
+	free(row);
+	free(ev);
+	free(commits);
+	free(targets);
+	free(btns);
+	free(custom);
+	return ret;
+}